@@ -1,5 +1,8 @@
 #include "apu.h"
 #include "cpu.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
 
 namespace nes {
 
@@ -9,10 +12,18 @@ static const uint8_t lengthCounterTable[32] = {
         12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
 };
 
+static const uint32_t cpuFreq          = 1789773;
+static const uint32_t frameCounterFreq = 240;
+
 static const uint16_t noisePeriodTable[16] = {
         4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
 };
 
+// in CPU cycles
+static const uint16_t dmcRateTable[16] = {
+        428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
 
 // https://www.nesdev.org/wiki/APU_Mixer
 #define PT(n) (95.52 / ((8128.0 / n) + 100))
@@ -116,6 +127,28 @@ void Pulse::stepSweep() {
     }
 }
 
+void Pulse::clockTimer(uint32_t clocks) {
+    if (clocks <= this->timer) {
+        this->timer -= clocks;
+        return;
+    }
+
+    // the first reload, then every period + 1 clocks
+    const uint32_t period = this->timerPeriod + 1;
+    clocks -= this->timer + 1;
+    this->dutyOffset = (this->dutyOffset + 1 + clocks / period) % 8;
+    this->timer      = this->timerPeriod - clocks % period;
+}
+
+uint32_t Pulse::clocksUntilOutputChange() const {
+    const bool silenced = this->timerPeriod < 8 || (this->timerPeriod > 0x7ff);
+    if (!this->enabled || !this->lengthCounter || silenced || !this->envelope.volume())
+        return UINT32_MAX;
+
+    // the duty cycle moves on the clock that finds the timer at 0
+    return this->timer;
+}
+
 Byte Pulse::sample() const {
     const bool high     = (dutyOn[this->dutyType] >> (7 - this->dutyOffset)) & 1;
     const bool silenced = this->timerPeriod < 8 || (this->timerPeriod > 0x7ff);
@@ -138,6 +171,27 @@ void Triangle::stepTimer() {
     }
 }
 
+void Triangle::clockTimer(uint32_t clocks) {
+    if (clocks <= this->timer) {
+        this->timer -= clocks;
+        return;
+    }
+
+    const uint32_t period = this->timerPeriod + 1;
+    clocks -= this->timer + 1;
+    this->timer = this->timerPeriod - clocks % period;
+
+    if (this->lengthCounter > 0 && this->linearCounterOffset > 0)
+        this->phase = (this->phase + 1 + clocks / period) % 32;
+}
+
+uint32_t Triangle::clocksUntilOutputChange() const {
+    if (!this->enabled || !this->timerPeriod || !this->lengthCounter || !this->linearCounterOffset)
+        return UINT32_MAX;
+
+    return this->timer;
+}
+
 void Triangle::stepLinearCounter() {
     if (this->reload)
         this->linearCounterOffset = this->linearCounterPeriod;
@@ -172,6 +226,33 @@ void Noise::stepTimer() {
     }
 }
 
+void Noise::clockTimer(uint32_t clocks) {
+    if (clocks <= this->timer) {
+        this->timer -= clocks;
+        return;
+    }
+
+    const uint32_t period = this->period + 1;
+    clocks -= this->timer + 1;
+    this->timer = this->period - clocks % period;
+
+    // once the shift register is 0 it stays 0
+    if (this->shiftRegister == 0)
+        return;
+
+    for (uint32_t shifts = 1 + clocks / period; shifts > 0; shifts--) {
+        this->shiftRegister |= uint16_t(((this->shiftRegister >> this->feedbackBit) ^ this->shiftRegister) & 0x1) << 15;
+        this->shiftRegister >>= 1;
+    }
+}
+
+uint32_t Noise::clocksUntilOutputChange() const {
+    if (!this->enabled || !this->lengthCounter || !this->envelope.volume() || !this->shiftRegister)
+        return UINT32_MAX;
+
+    return this->timer;
+}
+
 Byte Noise::sample() {
     if (!this->enabled || !this->lengthCounter || ~this->shiftRegister & 0x1)
         return 0;
@@ -184,14 +265,100 @@ void Noise::stepLength() {
         this->lengthCounter--;
 }
 
+Byte DMC::sample() const {
+    return this->outputLevel;
+}
+
+void DMC::restart() {
+    this->currentAddress = this->sampleAddress;
+    this->bytesRemaining = this->sampleLength;
+}
+
+void DMC::shiftOut() {
+    if (!this->silence) {
+        if (this->shiftRegister & 1) {
+            if (this->outputLevel <= 125)
+                this->outputLevel += 2;
+        } else if (this->outputLevel >= 2) {
+            this->outputLevel -= 2;
+        }
+    }
+    this->shiftRegister >>= 1;
+}
+
+bool DMC::clockOutput() {
+    this->shiftOut();
+
+    if (--this->bitsRemaining > 0)
+        return false;
+
+    // a new output cycle starts with whatever is in the buffer
+    this->bitsRemaining = 8;
+    this->silence       = !this->bufferFull;
+    if (!this->bufferFull)
+        return false;
+
+    this->shiftRegister = this->sampleBuffer;
+    this->bufferFull    = false;
+    return true;
+}
+
+bool DMC::fill(Byte data) {
+    this->sampleBuffer   = data;
+    this->bufferFull     = true;
+    this->currentAddress = this->currentAddress == 0xffff ? 0x8000 : this->currentAddress + 1;
+
+    if (--this->bytesRemaining > 0)
+        return false;
+
+    if (this->loop) {
+        this->restart();
+        return false;
+    }
+
+    this->irqFlag = this->irqEnabled;
+    return this->irqFlag;
+}
+
+void DMC::clockTimer(uint32_t cycles) {
+    if (cycles < this->timer) {
+        this->timer -= cycles;
+        return;
+    }
+
+    cycles -= this->timer;
+    const uint32_t clocks = 1 + cycles / this->timerPeriod;
+    this->timer           = this->timerPeriod - cycles % this->timerPeriod;
+
+    // the bits left in the shift register still move the output level, which the features report even without
+    // audio. With the buffer empty, every output cycle that starts after them is silent.
+    const uint32_t bits = std::min<uint32_t>(clocks, this->bitsRemaining);
+    for (uint32_t bit = 0; bit < bits; bit++)
+        this->shiftOut();
+
+    if (clocks >= this->bitsRemaining)
+        this->silence = true;
+
+    this->bitsRemaining = 8 - (8 - this->bitsRemaining + clocks) % 8;
+}
+
+uint64_t DMC::cyclesUntilClock() const {
+    return this->timer - 1;
+}
+
+uint64_t DMC::cyclesUntilBufferEmpty() const {
+    if (!this->bufferFull)
+        return UINT64_MAX;
+
+    // on the clock that ends the current output cycle
+    return this->timer - 1 + uint64_t(this->bitsRemaining - 1) * this->timerPeriod;
+}
+
 
 void APU::updateTicks() {
     // need to divide the CPU frequency into a non-integer amount.
     // this means that the positive edges won't consistently line up,
     // so need to detect positive edges that occur between CPU clock ticks
-    const static uint32_t frameCounterFreq = 240;
-    const static uint32_t cpuFreq          = 1789773;
-
     // calculate 240Hz ticks
     this->cyclesXFrameCounterFreq += frameCounterFreq;
     if (this->cyclesXFrameCounterFreq >= cpuFreq) {
@@ -200,15 +367,6 @@ void APU::updateTicks() {
     } else
         this->onFrameCounterEdge = false;
 
-
-    // calculate sample rate (probably 44.1 kHz) ticks
-    this->cyclesXSampleFreq += sampleFreq;
-    if (this->cyclesXSampleFreq >= cpuFreq) {
-        this->cyclesXSampleFreq -= cpuFreq;
-        this->onSampleEdge = true;
-    } else
-        this->onSampleEdge = false;
-
     this->onAPUCycle = !this->onAPUCycle;
 }
 
@@ -247,68 +405,362 @@ void APU::stepFrameCounter() {
             break;
     }
 
-    // TODO: check interrupts
+    // https://www.nesdev.org/wiki/APU_Frame_Counter
+    // the last step of the 4-step sequence sets the frame interrupt flag unless IRQs are inhibited
     if (stepWithPeriod == 0x44 && this->enableIRQ) {
-        this->console.cpu->interrupt(Interrupt::IRQ);
+        this->frameIRQ = true;
+        if (!this->replica)
+            this->console.cpu->interrupt(Interrupt::IRQ);
     }
 
     // increment the frame timerPeriod and wrap around
     this->framePeriod = (stepWithPeriod == 0x55 || stepWithPeriod == 0x44) ? 1 : this->framePeriod + 1;
 }
 
-float APU::sample() {
-    // TODO: noise + DMC
+float APU::mix() {
     // https://www.nesdev.org/wiki/APU_Mixer#Lookup_Table
     auto pulseSample = pulseTable[this->pulses[0].sample() + this->pulses[1].sample()];
-    auto tndSample   = tndTable[3 * this->triangle.sample() + 2 * this->noise.sample() + 0];
-    auto sampled     = pulseSample + tndSample;
+    auto tndSample   = tndTable[3 * this->triangle.sample() + 2 * this->noise.sample() + this->dmc.sample()];
+    return pulseSample + tndSample;
+}
 
-    for (auto &filter: this->filters)
-        sampled = filter.filter(sampled);
+void APU::endBlock() {
+    this->blip.endBlock(this->blockCycle);
+    this->blockCycle = 0;
 
-    return sampled;
+    // filter the whole block one filter at a time, then hand it over in one call
+    std::array<float, 256> samples;
+    while (size_t n = this->blip.readSamples(samples.data(), samples.size())) {
+        for (auto &filter: this->filters)
+            filter.filter(samples.data(), n);
+
+        if (this->sink != nullptr)
+            this->sink->writeSamples(samples.data(), n);
+    }
 }
 
-void APU::registerAudioCallback(ProcessAudioSample processAudioSampleFn) {
-    this->processSampleFn = processAudioSampleFn;
+void APU::setAudioSink(AudioSink *audioSink) {
+    // the worker's replica writes to the sink, so it is restarted around the change
+    const bool threaded = this->worker != nullptr;
+    this->setAudioThread(false);
+    this->sink = audioSink;
+    this->setAudioThread(threaded);
+}
+
+void APU::skip(uint64_t cycles) {
+    if (cycles == 0)
+        return;
+
+    if (this->audioEnabled) {
+        // pulse and noise timers are clocked every other cycle, starting with this one when onAPUCycle
+        const uint32_t apuClocks = (cycles + this->onAPUCycle) / 2;
+        this->pulses[0].clockTimer(apuClocks);
+        this->pulses[1].clockTimer(apuClocks);
+        this->noise.clockTimer(apuClocks);
+        this->triangle.clockTimer(cycles);
+        this->blockCycle += cycles;
+    }
+
+    this->dmc.clockTimer(cycles);
+
+    // the frame counter can't tick during the skipped cycles, but the last one can set up the tick
+    this->cyclesXFrameCounterFreq += frameCounterFreq * cycles;
+    this->onFrameCounterEdge = this->cyclesXFrameCounterFreq >= cpuFreq;
+    if (this->onFrameCounterEdge)
+        this->cyclesXFrameCounterFreq -= cpuFreq;
+
+    this->onAPUCycle ^= cycles & 1;
+    this->cycle += cycles;
+}
+
+uint64_t APU::cyclesUntilFrameTick() const {
+    // the frame counter ticks on the cycle after the one that wraps its accumulator
+    if (this->onFrameCounterEdge)
+        return 0;
+
+    return (cpuFreq - this->cyclesXFrameCounterFreq + frameCounterFreq - 1) / frameCounterFreq;
+}
+
+uint64_t APU::cyclesUntilBlockEnd() const {
+    return this->audioEnabled ? blockCycles - 1 - this->blockCycle : UINT64_MAX;
+}
+
+uint64_t APU::cyclesUntilSync() const {
+    // ticks that can't raise an IRQ are caught up with on the next register access
+    const bool irqPossible   = this->enableIRQ && !this->useFiveStep;
+    const uint64_t untilTick = irqPossible ? this->cyclesUntilFrameTick() : UINT64_MAX;
+
+    // DMC fetches stall the CPU and can raise an IRQ, a byte every 8 clocks at most
+    const bool fetchDue       = this->dmc.bytesRemaining > 0;
+    const uint64_t untilFetch = fetchDue ? this->dmc.cyclesUntilBufferEmpty() : UINT64_MAX;
+
+    return std::min({untilTick, untilFetch, this->cyclesUntilBlockEnd()});
+}
+
+uint64_t APU::cyclesUntilEvent() const {
+    uint64_t cycles = std::min({this->cyclesUntilFrameTick(), this->cyclesUntilBlockEnd(),
+                                this->dmc.cyclesUntilBufferEmpty()});
+    if (!this->audioEnabled)
+        return cycles;
+
+    if (this->outputChanged)
+        return 0;
+
+    // the DMC level moves on every clock while it plays
+    if (!this->dmc.silence)
+        cycles = std::min(cycles, this->dmc.cyclesUntilClock());
+
+    // pulse and noise clocks are two cycles apart
+    const uint64_t firstClock = this->onAPUCycle ? 0 : 1;
+    for (uint32_t clocks: {this->pulses[0].clocksUntilOutputChange(), this->pulses[1].clocksUntilOutputChange(),
+                           this->noise.clocksUntilOutputChange()})
+        if (clocks != UINT32_MAX)
+            cycles = std::min(cycles, firstClock + 2 * uint64_t(clocks));
+
+    return std::min<uint64_t>(cycles, this->triangle.clocksUntilOutputChange());
+}
+
+void APU::runUntil(uint64_t cpuCycle) {
+    while (this->cycle < cpuCycle) {
+        this->skip(std::min(this->cyclesUntilEvent(), cpuCycle - this->cycle));
+
+        if (this->cycle < cpuCycle)
+            this->step();
+    }
+
+    this->updateSyncCycle();
+}
+
+void APU::updateSyncCycle() {
+    const uint64_t cycles = this->cyclesUntilSync();
+    this->syncCycle       = (cycles == UINT64_MAX) ? UINT64_MAX : this->cycle + cycles;
+}
+
+void APU::setAudioEnabled(bool enabled) {
+    // with a worker running, audioEnabled is already off here
+    if (!enabled)
+        this->worker.reset();
+
+    if (enabled == this->audioEnabled || this->worker)
+        return;
+
+    this->runUntil(this->console.cycles);
+
+    // the channel timers stood still while disabled, which nobody could hear
+    this->audioEnabled  = enabled;
+    this->outputChanged = true;
+    this->updateSyncCycle();
+}
+
+void APU::setAudioThread(bool enabled) {
+    if (enabled == (this->worker != nullptr) || (enabled && !this->audioEnabled))
+        return;
+
+    this->runUntil(this->console.cycles);
+
+    if (enabled) {
+        this->worker = std::make_unique<AudioWorker>(*this);
+    } else {
+        // take synthesis back where the replica left off, so the audio continues seamlessly
+        this->worker->runUntil(this->cycle);
+        this->worker->finish();
+        this->copyState(this->worker->apu);
+        this->worker.reset();
+    }
+
+    this->audioEnabled  = !enabled;
+    this->outputChanged = true;
+    this->updateSyncCycle();
+}
+
+void APU::copyState(const APU &other) {
+    this->pulses[0]               = other.pulses[0];
+    this->pulses[1]               = other.pulses[1];
+    this->triangle                = other.triangle;
+    this->noise                   = other.noise;
+    this->dmc                     = other.dmc;
+    this->filters                 = other.filters;
+    this->blip                    = other.blip;
+    this->mixerOutput             = other.mixerOutput;
+    this->blockCycle              = other.blockCycle;
+    this->cyclesXFrameCounterFreq = other.cyclesXFrameCounterFreq;
+    this->cycle                   = other.cycle;
+    this->framePeriod             = other.framePeriod;
+    this->onFrameCounterEdge      = other.onFrameCounterEdge;
+    this->useFiveStep             = other.useFiveStep;
+    this->enableIRQ               = other.enableIRQ;
+    this->frameIRQ                = other.frameIRQ;
+    this->onAPUCycle              = other.onAPUCycle;
+    this->outputChanged           = true;
+}
+
+void APU::copyFrom(const APU &other) {
+    this->copyState(other);
+    this->sampleFreq      = other.sampleFreq;
+    this->frameCycle      = other.frameCycle;
+    this->levelCycle      = other.levelCycle;
+    this->levelSum        = other.levelSum;
+    this->levelSumSquares = other.levelSumSquares;
+    this->features        = other.features;
+
+    // a console with a worker synthesizes on its replica, the clone picks up from the channels here
+    this->audioEnabled = other.audioEnabled || other.worker;
+    this->updateSyncCycle();
+}
+
+void APU::endFrame() {
+    this->runUntil(this->console.cycles);
+
+    if (this->worker)
+        this->worker->runUntil(this->cycle);
+
+    this->updateFeatures();
+}
+
+void APU::fetchDMCSample(uint64_t atCycle) {
+    if (this->dmc.bufferFull || this->dmc.bytesRemaining == 0 || this->replica)
+        return;
+
+    // the CPU is halted while the DMC reads, for up to 4 cycles. Sample addresses are always in PRG.
+    // https://www.nesdev.org/wiki/APU_DMC#Memory_reader
+    const Byte data = this->console.mapper->Read(this->dmc.currentAddress);
+    this->console.cpu->stall(4);
+
+    if (this->worker)
+        this->worker->dmcSample(atCycle, data);
+
+    if (this->dmc.fill(data))
+        this->console.cpu->interrupt(Interrupt::IRQ);
+}
+
+void APU::accumulateLevel() {
+    const double cycles = double(this->cycle - this->levelCycle);
+    this->levelSum += this->mixerOutput * cycles;
+    this->levelSumSquares += double(this->mixerOutput) * this->mixerOutput * cycles;
+    this->levelCycle = this->cycle;
+}
+
+void APU::updateFeatures() {
+    // https://www.nesdev.org/wiki/APU_period_table
+    for (int i = 0; i < 2; i++) {
+        const auto &pulse           = this->pulses[i];
+        this->features.active[i]    = pulse.clocksUntilOutputChange() != UINT32_MAX;
+        this->features.frequency[i] = cpuFreq / (16.0f * (pulse.timerPeriod + 1));
+        this->features.volume[i]    = pulse.envelope.volume() / 15.0f;
+    }
+
+    this->features.active[2]    = this->triangle.clocksUntilOutputChange() != UINT32_MAX;
+    this->features.frequency[2] = cpuFreq / (32.0f * (this->triangle.timerPeriod + 1));
+    this->features.volume[2]    = this->features.active[2];
+
+    this->features.active[3]    = this->noise.enabled && this->noise.lengthCounter && this->noise.envelope.volume();
+    this->features.frequency[3] = cpuFreq / (2.0f * (this->noise.period + 1));
+    this->features.volume[3]    = this->noise.envelope.volume() / 15.0f;
+
+    this->features.active[4]    = !this->dmc.silence || this->dmc.bytesRemaining > 0;
+    this->features.frequency[4] = float(cpuFreq) / this->dmc.timerPeriod;
+    this->features.volume[4]    = this->dmc.outputLevel / 127.0f;
+
+    // without audio the output level isn't known
+    this->features.rms = 0;
+    if (this->audioEnabled && this->cycle > this->frameCycle) {
+        this->accumulateLevel();
+
+        const double cycles = double(this->cycle - this->frameCycle);
+        const double mean   = this->levelSum / cycles;
+        this->features.rms  = float(std::sqrt(std::max(0.0, this->levelSumSquares / cycles - mean * mean)));
+    }
+
+    this->frameCycle      = this->cycle;
+    this->levelCycle      = this->cycle;
+    this->levelSum        = 0;
+    this->levelSumSquares = 0;
+}
+
+const AudioFeatures &APU::frameFeatures() const {
+    return this->features;
+}
+
+uint64_t APU::nextSyncCycle() const {
+    return this->syncCycle;
 }
 
 APU::APU(Console &c) :
-    console(c) {
+    console(c), blip(cpuFreq, sampleFreq, blockCycles * uint64_t(sampleFreq) / cpuFreq + 1) {
     this->pulses[1].sweep.carry = 1;
 }
 
+APU::~APU() = default;
+
 void APU::step() {
-    if (this->onAPUCycle) {
-        // pulse + noise + dmc
+    if (this->audioEnabled && this->onAPUCycle) {
+        // pulse + noise, every other CPU cycle
         this->pulses[0].stepTimer();
         this->pulses[1].stepTimer();
         this->noise.stepTimer();
     }
 
-    // TODO: DMC + Noise
-    this->triangle.stepTimer();
+    // the triangle every CPU cycle
+    if (this->audioEnabled)
+        this->triangle.stepTimer();
+
+    // the DMC runs without audio as well, its fetches are seen by the CPU
+    if (--this->dmc.timer == 0) {
+        this->dmc.timer = this->dmc.timerPeriod;
+        if (this->dmc.clockOutput())
+            this->fetchDMCSample(this->cycle + 1);
+    }
 
     if (this->onFrameCounterEdge)
         this->stepFrameCounter();
 
-    if (this->onSampleEdge && this->processSampleFn != nullptr)
-        this->processSampleFn(this->sample());
+    if (this->audioEnabled) {
+        // only changes in the output cost anything to resample
+        auto output = this->mix();
+        if (output != this->mixerOutput) {
+            this->accumulateLevel();
+            this->blip.addDelta(this->blockCycle, output - this->mixerOutput);
+            this->mixerOutput = output;
+        }
+        this->outputChanged = false;
+
+        if (++this->blockCycle == blockCycles)
+            this->endBlock();
+    }
 
     this->updateTicks();
+    this->cycle++;
 }
 
-Byte APU::readRegister(Address addr) const {
+Byte APU::readRegister(Address addr) {
+    // the CPU sees the APU as of the start of the instruction
+    this->runUntil(this->console.cycles);
+
     switch (addr) {
-        case 0x4015:
-            // TODO: triangle + dmc + noise
-            return (this->pulses[0].lengthCounter) | (!!this->pulses[1].lengthCounter << 1) |
-                   (!!this->triangle.lengthCounter << 2);
+        case 0x4015: {
+            // https://www.nesdev.org/wiki/APU#Status_($4015)
+            // reading clears the frame interrupt flag, but not the DMC's
+            const bool frameIRQ = std::exchange(this->frameIRQ, false);
+            return (!!this->pulses[0].lengthCounter) | (!!this->pulses[1].lengthCounter << 1) |
+                   (!!this->triangle.lengthCounter << 2) | (!!this->noise.lengthCounter << 3) |
+                   ((this->dmc.bytesRemaining > 0) << 4) | (frameIRQ << 6) | (this->dmc.irqFlag << 7);
+        }
     }
     return 0;
 }
 
 void APU::writeRegister(Address addr, Byte data) {
+    this->runUntil(this->console.cycles);
+
+    if (this->worker)
+        this->worker->write(this->console.cycles, addr, data);
+
+    this->applyWrite(addr, data);
+}
+
+void APU::applyWrite(Address addr, Byte data) {
+    this->outputChanged = true;
+
     Byte pulseReg = (addr & 0x4) >> 2;
 
     switch (addr) {
@@ -375,9 +827,20 @@ void APU::writeRegister(Address addr, Byte data) {
             this->noise.envelope.start = true;
             break;
         case 0x4010:
+            this->dmc.irqEnabled  = (data >> 7) & 1;
+            this->dmc.loop        = (data >> 6) & 1;
+            this->dmc.timerPeriod = dmcRateTable[data & 0xf];
+            if (!this->dmc.irqEnabled)
+                this->dmc.irqFlag = false;
+            break;
         case 0x4011:
+            this->dmc.outputLevel = data & 0x7f;
+            break;
         case 0x4012:
+            this->dmc.sampleAddress = 0xc000 | Address(data) << 6;
+            break;
         case 0x4013:
+            this->dmc.sampleLength = (uint16_t(data) << 4) + 1;
             break;
         case 0x4015:
             this->pulses[0].enabled = data & 0x1;
@@ -395,11 +858,23 @@ void APU::writeRegister(Address addr, Byte data) {
             if (!this->noise.enabled)
                 this->noise.lengthCounter = 0;
 
+            this->dmc.irqFlag = false;
+            if (!((data >> 4) & 1)) {
+                this->dmc.bytesRemaining = 0;
+            } else if (this->dmc.bytesRemaining == 0) {
+                this->dmc.restart();
+                this->fetchDMCSample(this->cycle);
+            }
+
             break;
         case 0x4017:
             this->useFiveStep = (data >> 7) & 1;
             this->enableIRQ   = (~data >> 6) & 1;
 
+            // setting the inhibit flag clears the frame interrupt flag
+            if (!this->enableIRQ)
+                this->frameIRQ = false;
+
             if (this->useFiveStep) {
                 for (auto i = 0; i < 2; i++) {
                     this->pulses[i].envelope.step();
@@ -413,6 +888,92 @@ void APU::writeRegister(Address addr, Byte data) {
             }
             break;
     }
+
+    // enabling the frame IRQ makes its ticks due
+    this->updateSyncCycle();
+}
+
+AudioWorker::AudioWorker(const APU &original) :
+    apu(original.console) {
+    this->apu.replica = true;
+    this->apu.sink    = original.sink;
+    this->apu.copyState(original);
+
+    this->thread = std::thread(&AudioWorker::loop, this);
+}
+
+AudioWorker::~AudioWorker() {
+    this->finish();
+}
+
+void AudioWorker::finish() {
+    if (!this->thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wakeup.notify_one();
+    this->thread.join();
+}
+
+void AudioWorker::write(uint64_t cycle, Address addr, Byte data) {
+    this->push({Event::RegisterWrite, cycle, addr, data});
+}
+
+void AudioWorker::dmcSample(uint64_t cycle, Byte data) {
+    this->push({Event::DMCSample, cycle, 0, data});
+}
+
+void AudioWorker::runUntil(uint64_t cycle) {
+    this->push({Event::RunUntil, cycle, 0, 0});
+    this->notify();
+}
+
+void AudioWorker::push(const Event &event) {
+    // events can't be dropped, so wait for the worker to make room
+    while (!this->events.push(event)) {
+        this->notify();
+        std::this_thread::yield();
+    }
+}
+
+void AudioWorker::notify() {
+    // taking the lock orders the push before the worker's check, so the wakeup can't be missed
+    { std::lock_guard<std::mutex> lock(this->mutex); }
+    this->wakeup.notify_one();
+}
+
+void AudioWorker::loop() {
+    std::array<Event, 256> batch;
+
+    while (true) {
+        const size_t n = this->events.pop(batch.data(), batch.size());
+        if (n == 0) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wakeup.wait(lock, [this] { return this->events.size() > 0 || this->stopping; });
+
+            if (this->events.size() == 0)
+                return;
+            continue;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            this->apu.runUntil(batch[i].cycle);
+
+            switch (batch[i].kind) {
+                case Event::RunUntil:
+                    break;
+                case Event::RegisterWrite:
+                    this->apu.applyWrite(batch[i].addr, batch[i].data);
+                    break;
+                case Event::DMCSample:
+                    this->apu.dmc.fill(batch[i].data);
+                    break;
+            }
+        }
+    }
 }
 
-} // namespace nes
\ No newline at end of file
+} // namespace nes
@@ -2,6 +2,10 @@
 #include "console.h"
 #include "dsp.h"
 #include "nes.h"
+#include "ring.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace nes {
 
@@ -59,6 +63,10 @@ struct Pulse {
     void stepTimer();
     void stepLength();
     void stepSweep();
+
+    // bulk versions of stepTimer for the APU cycles where nothing is heard
+    void clockTimer(uint32_t clocks);
+    uint32_t clocksUntilOutputChange() const;
 };
 
 struct Triangle {
@@ -76,6 +84,9 @@ struct Triangle {
     void stepLength();
     void stepLinearCounter();
     Byte sample();
+
+    void clockTimer(uint32_t clocks);
+    uint32_t clocksUntilOutputChange() const;
 };
 
 struct Noise {
@@ -89,18 +100,63 @@ struct Noise {
     void stepTimer();
     void stepLength();
     Byte sample();
+
+    void clockTimer(uint32_t clocks);
+    uint32_t clocksUntilOutputChange() const;
+};
+
+// Plays 1-bit delta samples fetched from PRG. Timed in CPU cycles and only clocked when it matters,
+// see cyclesUntilBufferEmpty.
+// https://www.nesdev.org/wiki/APU_DMC
+struct DMC {
+    bool irqEnabled         = false;
+    bool loop               = false;
+    bool irqFlag            = false;
+    uint16_t timerPeriod    = 428;
+    uint16_t timer          = 428; // CPU cycles until the output unit is clocked, counting that one
+    Byte outputLevel        = 0;   // 7 bits
+    Address sampleAddress   = 0xc000;
+    uint16_t sampleLength   = 1;
+    Address currentAddress  = 0xc000;
+    uint16_t bytesRemaining = 0;
+    Byte sampleBuffer       = 0;
+    bool bufferFull         = false;
+    Byte shiftRegister      = 0;
+    Byte bitsRemaining      = 8;
+    bool silence            = true;
+
+    Byte sample() const;
+    void restart();
+    // move the output level by the next bit of the shift register
+    void shiftOut();
+    // true when the sample buffer was emptied into the shift register
+    bool clockOutput();
+    // store a fetched byte, true when it was the last one and raises an IRQ
+    bool fill(Byte data);
+
+    // cycles in which no byte is taken from the sample buffer
+    void clockTimer(uint32_t cycles);
+    uint64_t cyclesUntilClock() const;
+    uint64_t cyclesUntilBufferEmpty() const;
 };
 
-struct DMC {};
+class AudioWorker;
 
 class APU {
+    friend AudioWorker;
+
+#ifdef _NES_TEST
+public:
+#else
 private:
+#endif
     Console &console;
-    ProcessAudioSample processSampleFn;
+    AudioSink *sink = nullptr;
 
-    Pulse pulses[2];
-    Triangle triangle;
-    Noise noise;
+    Pulse pulses[2]{};
+    Triangle triangle{};
+    Noise noise{};
+    DMC dmc{};
 
     std::array<FirstOrderFilter, 3> filters{
             HighPassFilter(48000, 90),
@@ -108,34 +164,138 @@ private:
             LowPassFilter(48000, 14000),
     };
 
+    // the mixer output is recorded as steps and resampled once per block
+    static const uint32_t blockCycles = 4096;
+    uint32_t sampleFreq               = 48000;
+    BlipBuffer blip;
+    float mixerOutput                 = 0;
+    uint32_t blockCycle               = 0;
+
+    // the mixer output integrated over the frame so far, for the rms in the features
+    uint64_t frameCycle               = 0;
+    uint64_t levelCycle               = 0;
+    double levelSum                   = 0;
+    double levelSumSquares            = 0;
+    AudioFeatures features            = {};
+
     uint32_t cyclesXFrameCounterFreq = 0;
-    uint32_t cyclesXSampleFreq       = 0;
-    uint32_t sampleFreq              = 48000;
+
+    // the APU is only run when something can be heard or observed, see runUntil
+    uint64_t cycle                   = 0;
+    uint64_t syncCycle               = 0;
+    bool outputChanged               = false;
+    bool audioEnabled                = true;
+
+    // with a worker, audio is synthesized on its replica and this APU only keeps what the CPU sees.
+    // A replica never raises IRQs.
+    std::unique_ptr<AudioWorker> worker;
+    bool replica                     = false;
 
     Byte framePeriod                 = 1;
 
     bool onFrameCounterEdge          = false;
-    bool onSampleEdge                = false;
     bool useFiveStep                 = false;
     bool enableIRQ                   = false;
+    bool frameIRQ                    = false; // bit 6 of $4015
     bool onAPUCycle                  = true;
 
     void updateTicks();
     void stepFrameCounter();
-    float sample();
+    float mix();
+    void endBlock();
+    void accumulateLevel();
+    // read the next sample byte into the empty buffer, at the cycle the replica should get it
+    void fetchDMCSample(uint64_t atCycle);
+    void updateFeatures();
 
+    // a single CPU cycle
+    void step();
+    // cycles in which no channel changes its output and the frame counter doesn't tick
+    void skip(uint64_t cycles);
+    uint64_t cyclesUntilEvent() const;
+    uint64_t cyclesUntilFrameTick() const;
+    uint64_t cyclesUntilBlockEnd() const;
+    uint64_t cyclesUntilSync() const;
+    void updateSyncCycle();
+
+    void applyWrite(Address addr, Byte data);
+    // everything but the sink and the worker, to hand synthesis over between threads
+    void copyState(const APU &other);
 
 public:
     APU(Console &);
-    // receive a CPU clock
-    void step();
+    ~APU();
+
+    // run the APU up to a CPU cycle, stepping only through the cycles where something changes
+    void runUntil(uint64_t cpuCycle);
+
+    // the APU has to be run past this cycle even without register accesses, for frame IRQs and audio blocks
+    uint64_t nextSyncCycle() const;
 
-    void registerAudioCallback(ProcessAudioSample processAudioSampleFn);
+    void setAudioSink(AudioSink *audioSink);
+
+    // without audio only what the CPU can observe is emulated: length counters, $4015 and IRQs
+    void setAudioEnabled(bool enabled);
+
+    // move synthesis to a worker thread that replays the register writes. The callback is then called there.
+    void setAudioThread(bool enabled);
+
+    // the console finished a frame: the worker may synthesize up to here, and the features are taken
+    void endFrame();
+
+    const AudioFeatures &frameFeatures() const;
+
+    // the state of another console's APU, for a cloned console, which has no sink yet and no worker
+    void copyFrom(const APU &other);
 
     // Only supports 0x4015
-    Byte readRegister(Address addr) const;
+    Byte readRegister(Address addr);
 
     void writeRegister(Address addr, Byte data);
 };
 
+// Synthesizes and filters audio on its own thread, from register writes timestamped with the CPU cycle.
+// The emulation thread only waits on it when the queue of events is full.
+class AudioWorker {
+    friend APU;
+
+private:
+    struct Event {
+        enum Kind : uint8_t {
+            RunUntil,
+            RegisterWrite,
+            DMCSample, // the replica doesn't read memory, it gets the bytes the original fetched
+        };
+
+        Kind kind;
+        uint64_t cycle;
+        Address addr;
+        Byte data;
+    };
+
+    APU apu;
+    SPSCRing<Event> events{4096};
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::thread thread;
+
+    void push(const Event &event);
+    void notify();
+    void loop();
+
+public:
+    // starts from the channel and frame counter state of the original
+    explicit AudioWorker(const APU &original);
+    ~AudioWorker();
+
+    // synthesize whatever was queued and stop the thread
+    void finish();
+
+    void write(uint64_t cycle, Address addr, Byte data);
+    void dmcSample(uint64_t cycle, Byte data);
+    void runUntil(uint64_t cycle);
+};
+
 } // namespace nes
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "audiorender.h"
+#include "console.h"
+#include "rom.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+
+namespace nes {
+
+static const uint32_t apuSampleRate = 48000;
+
+WavWriter::WavWriter(const std::string &path, uint32_t sampleRate) :
+    buffer(1 << 16), sampleRate(sampleRate) {
+    if (path == "-") {
+        this->file = stdout;
+    } else {
+        this->file     = fopen(path.c_str(), "wb");
+        this->ownsFile = true;
+    }
+
+    if (this->file == nullptr)
+        throw std::runtime_error(std::string("failed to open: ") + path);
+
+    // stdout outlives the writer, so it keeps its own buffer
+    if (this->ownsFile)
+        setvbuf(this->file, this->buffer.data(), _IOFBF, this->buffer.size());
+
+    this->writeHeader(UINT32_MAX);
+}
+
+WavWriter::~WavWriter() {
+    this->close();
+}
+
+void WavWriter::writeHeader(uint32_t dataBytes) {
+    // http://soundfile.sapp.org/doc/WaveFormat/
+    const uint16_t channels      = 1;
+    const uint16_t bitsPerSample = 16;
+    const uint16_t blockAlign    = channels * bitsPerSample / 8;
+    const uint32_t byteRate      = this->sampleRate * blockAlign;
+    const uint32_t riffBytes     = dataBytes == UINT32_MAX ? UINT32_MAX : 36 + dataBytes;
+
+    struct {
+        char riff[4]            = {'R', 'I', 'F', 'F'};
+        uint32_t riffSize;
+        char wave[4]            = {'W', 'A', 'V', 'E'};
+        char fmt[4]             = {'f', 'm', 't', ' '};
+        uint32_t fmtSize        = 16;
+        uint16_t audioFormat    = 1; // PCM
+        uint16_t numChannels;
+        uint32_t sampleRate;
+        uint32_t byteRate;
+        uint16_t blockAlign;
+        uint16_t bitsPerSample;
+        char data[4]            = {'d', 'a', 't', 'a'};
+        uint32_t dataSize;
+    } header;
+    static_assert(sizeof(header) == 44);
+
+    header.riffSize      = riffBytes;
+    header.numChannels   = channels;
+    header.sampleRate    = this->sampleRate;
+    header.byteRate      = byteRate;
+    header.blockAlign    = blockAlign;
+    header.bitsPerSample = bitsPerSample;
+    header.dataSize      = dataBytes;
+
+    fwrite(&header, sizeof(header), 1, this->file);
+}
+
+void WavWriter::write(const float samples[], size_t n) {
+    std::array<int16_t, 512> pcm;
+
+    while (n > 0) {
+        const size_t count = std::min(n, pcm.size());
+        for (size_t i = 0; i < count; i++)
+            pcm[i] = int16_t(std::lround(std::clamp(samples[i], -1.0f, 1.0f) * 32767));
+
+        if (fwrite(pcm.data(), sizeof(int16_t), count, this->file) != count)
+            throw std::runtime_error("failed to write audio");
+
+        this->samplesWritten += count;
+        samples += count;
+        n -= count;
+    }
+}
+
+void WavWriter::close() {
+    if (this->file == nullptr)
+        return;
+
+    const uint64_t dataBytes = this->samplesWritten * sizeof(int16_t);
+    if (dataBytes < UINT32_MAX - 36 && fseek(this->file, 0, SEEK_SET) == 0)
+        this->writeHeader(uint32_t(dataBytes));
+
+    if (this->ownsFile)
+        fclose(this->file);
+    else
+        fflush(this->file);
+
+    this->file = nullptr;
+}
+
+void RenderAudio(const AudioRenderJob &job) {
+    std::ifstream inputFile(job.inputPath, std::ios::binary);
+    if (!inputFile)
+        throw std::runtime_error(std::string("failed to open: ") + job.inputPath);
+
+    const std::vector<Byte> inputs{std::istreambuf_iterator<char>(inputFile), std::istreambuf_iterator<char>()};
+
+    auto console = Console::Create(LoadRomFile(job.romPath));
+    WavWriter wav(job.wavPath, apuSampleRate);
+    console->RegisterAudioCallback([&wav](float samples[], size_t n) { wav.write(samples, n); });
+
+    // frames are still emulated in full, games wait on vblank and sprite zero, but nothing converts them
+    for (Byte buttons: inputs) {
+        for (uint8_t b = 0; b < 8; b++)
+            console->SetButton(static_cast<Buttons>(b), (buttons >> b) & 1);
+
+        console->StepFrame();
+    }
+
+    console->RegisterAudioCallback(nullptr);
+    wav.close();
+}
+
+size_t RenderAudio(const std::vector<AudioRenderJob> &jobs, size_t numThreads) {
+    // consoles share nothing, so each job runs start to finish on one thread. The caller is one of them.
+    // an exception's message can be empty, so only a set entry means the job failed
+    std::vector<std::optional<std::string>> errors(jobs.size());
+    ThreadPool pool(numThreads > 0 ? numThreads - 1 : 0);
+
+    pool.parallelFor(jobs.size(), [&jobs, &errors](size_t i) {
+        try {
+            RenderAudio(jobs[i]);
+        } catch (std::exception &exc) {
+            // anything escaping a pool thread would terminate the whole batch
+            errors[i] = exc.what();
+        }
+    });
+
+    size_t failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (errors[i]) {
+            std::cerr << jobs[i].romPath << ": " << *errors[i] << std::endl;
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+} // namespace nes
@@ -0,0 +1,43 @@
+#pragma once
+#include "nes.h"
+#include <stdio.h>
+#include <string>
+
+namespace nes {
+
+// 16-bit mono PCM through a large stdio buffer. The header sizes are filled in on close when the file is seekable,
+// a stream like stdout keeps the "unknown length" sizes.
+class WavWriter {
+private:
+    FILE *file    = nullptr;
+    bool ownsFile = false;
+    std::vector<char> buffer;
+    uint32_t sampleRate;
+    uint64_t samplesWritten = 0;
+
+    void writeHeader(uint32_t dataBytes);
+
+public:
+    // "-" writes to stdout
+    WavWriter(const std::string &path, uint32_t sampleRate);
+    ~WavWriter();
+
+    void write(const float samples[], size_t n);
+    void close();
+};
+
+// A ROM played with the buttons from an input log, its audio written to a WAV file.
+struct AudioRenderJob {
+    std::string romPath;
+    std::string inputPath; // a byte per frame: A, B, Select, Start, Up, Down, Left, Right from bit 0
+    std::string wavPath;   // "-" for stdout
+};
+
+// Run the console as fast as it goes, one frame per input byte and without drawing anything.
+// Throws std::runtime_error when a file can't be read or written.
+void RenderAudio(const AudioRenderJob &job);
+
+// Render the jobs on numThreads cores, returning how many failed. Failures are reported on stderr.
+size_t RenderAudio(const std::vector<AudioRenderJob> &jobs, size_t numThreads);
+
+} // namespace nes
@@ -1,426 +1,510 @@
 #include "cartridge.h"
+#include <algorithm>
 
 namespace nes {
 
+PagedRAM::PagedRAM(const PagedRAM &other) :
+    pages(other.pages), ownedPages(other.pages.size(), false), bytes(other.bytes) {
+    // someone else's memory only has one writer
+    if (other.owner) {
+        for (auto &page: this->pages)
+            page = std::make_shared<Page>(*page);
+        this->ownedPages.assign(this->pages.size(), true);
+        return;
+    }
+
+    // both sides copy a page before writing to it from now on, whichever goes first
+    other.ownedPages.assign(other.pages.size(), false);
+}
+
+void PagedRAM::resize(size_t size) {
+    this->bytes = size;
+    this->pages.resize((size + PAGE_SIZE - 1) / PAGE_SIZE);
+    this->ownedPages.resize(this->pages.size(), true);
+    for (auto &page: this->pages)
+        if (!page)
+            page = std::make_shared<Page>();
+}
+
+void PagedRAM::mapOnto(std::span<Byte> memory, std::shared_ptr<void> owner) {
+    // pages that don't fit stay where they are
+    for (size_t i = 0; i < this->pages.size() && (i + 1) * PAGE_SIZE <= memory.size(); i++) {
+        this->pages[i]      = std::shared_ptr<Page>(reinterpret_cast<Page *>(&memory[i * PAGE_SIZE]), [](Page *) {});
+        this->ownedPages[i] = true;
+    }
+
+    this->owner = std::move(owner);
+}
+
 Mapper::Mapper(nes::PCartridge &&c) :
     cartridge(std::move(c)) {
 }
 
-void Mapper::OnScanline() {
+Mapper::Mapper(const Mapper &other) :
+    prgPages(other.prgPages), chrPages(other.chrPages), gameGenieCodes(other.gameGenieCodes),
+    cartridge(std::make_unique<Cartridge>(*other.cartridge)) {
+    // the save file stays with the original, the clone's RAM is a copy of it
+    this->cartridge->save.reset();
+}
+
+bool Mapper::OnScanline() {
+    return false;
+}
+
+void Mapper::mapCHR(size_t page, size_t offset) {
+    // out of range banks read as 0 through Read
+    if (offset + 0x400 > this->cartridge->chrSize())
+        this->chrPages[page] = nullptr;
+    else if (!this->cartridge->chrRAM.empty())
+        this->chrPages[page] = this->cartridge->chrRAM.page(offset);
+    else
+        this->chrPages[page] = &this->cartridge->chrROM[offset];
+
+    if (auto patched = this->cartridge->chrPatches.find(offset); patched != this->cartridge->chrPatches.end())
+        this->chrPages[page] = patched->second.data();
 }
 
-bool Mapper::CheckIRQ() {
-    auto irqStatus   = this->pendingIRQ;
-    this->pendingIRQ = false;
-    return irqStatus;
+void Mapper::mapPRG(size_t cpuPage, size_t offset) {
+    // out of range banks read as 0
+    if (offset + Cartridge::PRG_PAGE_SIZE > this->cartridge->prgROM.size()) {
+        this->prgPages[cpuPage] = nullptr;
+        return;
+    }
+
+    const Byte *page = &this->cartridge->prgROM[offset];
+    if (auto patched = this->cartridge->prgPatches.find(offset); patched != this->cartridge->prgPatches.end())
+        page = patched->second.data();
+
+    if (this->gameGenieCodes.empty()) {
+        this->prgPages[cpuPage] = page;
+        return;
+    }
+
+    // the same bank can be mapped at several addresses, and each sees its own codes
+    auto [cached, inserted] = this->gameGeniePages.try_emplace({offset, cpuPage});
+    if (inserted) {
+        for (auto &code: this->gameGenieCodes) {
+            const size_t i = code.addr % Cartridge::PRG_PAGE_SIZE;
+            if ((code.addr - 0x8000) / Cartridge::PRG_PAGE_SIZE != cpuPage || (code.compare && page[i] != *code.compare))
+                continue;
+
+            if (cached->second.empty())
+                cached->second.assign(page, page + Cartridge::PRG_PAGE_SIZE);
+            cached->second[i] = code.value;
+        }
+    }
+
+    this->prgPages[cpuPage] = cached->second.empty() ? page : cached->second.data();
 }
 
-void Mapper::triggerIRQ() {
-    this->pendingIRQ = true;
+void Mapper::AddGameGenieCode(const GameGenieCode &code) {
+    this->gameGenieCodes.push_back(code);
+    this->Remap();
 }
 
-class UxROM : public Mapper {
+void Mapper::Remap() {
+    this->gameGeniePages.clear();
+    this->mapBanks();
+}
+
+// a copy of the board for a cloned console, its pages pointed at its own cartridge
+template<typename Board>
+static std::unique_ptr<Mapper> cloneMapper(const Board &mapper) {
+    auto clone = std::make_unique<Board>(mapper);
+    clone->Remap();
+    return clone;
+}
+
+// A window of the CPU or PPU address space that one bank of its size is mapped into.
+// Switchable windows take their bank from the board's registers, the others always show fixedBank.
+struct BankWindow {
+    Address start;
+    uint16_t size;
+    bool switchable = false;
+    int fixedBank   = 0; // negative banks count back from the last one
+};
+
+// A bank's offset in a ROM of total bytes. Banks past the end wrap around like the unconnected high address lines.
+static size_t bankOffset(int bank, size_t windowSize, size_t total) {
+    const size_t count = std::max<size_t>(total / windowSize, 1);
+    const size_t index = bank >= 0 ? size_t(bank) % count : (count - size_t(-bank) % count) % count;
+    return index * windowSize;
+}
+
+// A board described by its bank windows: Board::prg for CPU $8000-$FFFF, Board::chr for PPU $0000-$1FFF, and
+// Board::hasPRGRAM for 8 KB of RAM at $6000. Boards only pick banks in writeRegister, the windows are turned into
+// 8 KB PRG and 1 KB CHR page tables which every access goes through.
+template<typename Board>
+class BankedMapper : public Mapper {
 private:
-    Address firstBankStart  = 0x0000;
-    Address secondBankStart = 0x0000;
+    static const size_t prgPageSize = Cartridge::PRG_PAGE_SIZE;
+    static const size_t chrPageSize = Cartridge::CHR_PAGE_SIZE;
+
+    // PPU $0000-$1FFF as offsets into CHR ROM/RAM, for writes
+    std::array<size_t, 8> chrOffsets = {0};
+
+protected:
+    // the bank in each window, ignored for fixed windows
+    std::array<int, Board::prg.size()> prgBanks = {0};
+    std::array<int, Board::chr.size()> chrBanks = {0};
+
+    // call after changing banks
+    void mapBanks() final {
+        const size_t totalPRG = this->cartridge->prgROM.size();
+        const size_t totalCHR = this->cartridge->chrSize();
+
+        for (size_t w = 0; w < Board::prg.size(); w++) {
+            const BankWindow &window = Board::prg[w];
+            const size_t bankStart =
+                    bankOffset(window.switchable ? this->prgBanks[w] : window.fixedBank, window.size, totalPRG);
+
+            for (size_t i = 0; i < window.size; i += prgPageSize) {
+                // ROMs smaller than the window are mirrored
+                const size_t offset = totalPRG > 0 ? (bankStart + i) % totalPRG : 0;
+                this->mapPRG((window.start - 0x8000 + i) / prgPageSize, offset);
+            }
+        }
+
+        for (size_t w = 0; w < Board::chr.size(); w++) {
+            const BankWindow &window = Board::chr[w];
+            const size_t bankStart =
+                    bankOffset(window.switchable ? this->chrBanks[w] : window.fixedBank, window.size, totalCHR);
+
+            for (size_t i = 0; i < window.size; i += chrPageSize) {
+                const size_t offset    = totalCHR > 0 ? (bankStart + i) % totalCHR : 0;
+                const size_t page      = (window.start + i) / chrPageSize;
+                this->chrOffsets[page] = offset;
+                this->mapCHR(page, offset);
+            }
+        }
+    }
+
+    // a write to $8000-$FFFF, the banks are mapped afterwards
+    virtual void writeRegister(Address addr, Byte data) = 0;
 
 public:
-    UxROM(PCartridge &&c) :
+    BankedMapper(PCartridge &&c) :
         Mapper(std::move(c)) {
-        this->secondBankStart = (this->cartridge->prgROM.size() - 1) & ~0x3fff;
+        this->mapBanks();
     }
 
-    const Byte *DMAStart(nes::Address addr) const override {
-        if (addr < 0x2000)
-            return &this->cartridge->chrROM[addr % 0x2000];
-        else if (addr < 0x8000)
-            return nullptr;
-        else if (addr < 0xC000)
-            // CPU $8000-$BFFF: 16 KB switchable PRG ROM bank
-            return &this->cartridge->prgROM[this->secondBankStart | (addr % 0x4000)];
-        else
-            // CPU $C000-$FFFF: 16 KB PRG ROM bank, fixed to the last bank
-            return &this->cartridge->prgROM[this->firstBankStart | (addr % 0x4000)];
+    Byte Read(Address addr) const final {
+        if (addr < 0x2000) {
+            const Byte *page = this->CHRPage(addr);
+            return page ? page[addr % chrPageSize] : 0;
+        } else if (addr < 0x6000) {
+            // not mapped to PPU or CPU
+            return 0;
+        } else if (addr < 0x8000) {
+            // CPU $6000-$7FFF: 8 KB PRG RAM, looked up every time since its pages move to a save file or to copies
+            addr %= 0x2000;
+            return Board::hasPRGRAM && addr < this->cartridge->prgRAM.size() ? this->cartridge->prgRAM.read(addr) : 0;
+        }
+
+        const Byte *page = this->PRGPage(addr);
+        return page ? page[addr % prgPageSize] : 0;
     }
 
-    Byte Read(nes::Address addr) const override {
-        if (addr < 0x2000)
-            return this->cartridge->chrROM[addr % 0x2000];
-        else if (addr < 0x8000)
-            return 0;
-        else if (addr < 0xC000)
-            // CPU $8000-$BFFF: 16 KB switchable PRG ROM bank
-            return this->cartridge->prgROM[this->firstBankStart | (addr % 0x4000)];
-        else
-            // CPU $C000-$FFFF: 16 KB PRG ROM bank, fixed to the last bank
-            return this->cartridge->prgROM[this->secondBankStart | (addr % 0x4000)];
+    const Byte *DMAStart(Address addr) const final {
+        // pages are larger than a DMA, so the 256 bytes never cross into the next one
+        if (addr < 0x2000) {
+            const Byte *page = this->CHRPage(addr);
+            return page ? page + addr % chrPageSize : nullptr;
+        } else if (addr < 0x6000) {
+            return nullptr;
+        } else if (addr < 0x8000) {
+            addr %= 0x2000;
+            return Board::hasPRGRAM && size_t(addr) + 256 <= this->cartridge->prgRAM.size()
+                           ? this->cartridge->prgRAM.page(addr) + addr % PagedRAM::PAGE_SIZE
+                           : nullptr;
+        }
+
+        const Byte *page = this->PRGPage(addr);
+        return page ? page + addr % prgPageSize : nullptr;
     }
 
-    void Write(nes::Address addr, Byte data) override {
-        if (addr < 0x2000)
-            this->cartridge->chrROM[addr] = data;
-        else if (addr < 0x8000)
-            // CPU $8000-$BFFF: 16 KB switchable PRG ROM bank
+    void Write(Address addr, Byte data) final {
+        if (addr < 0x2000) {
+            // only boards with CHR RAM take writes, and a page shared with a clone moves to a copy
+            if (this->cartridge->writeCHR(this->chrOffsets[addr / chrPageSize] | addr % chrPageSize, data))
+                this->mapBanks();
+        } else if (addr < 0x6000) {
             return;
-        else
-            this->firstBankStart = (Address(data & 0x0f) << 16) % this->cartridge->prgROM.size();
+        } else if (addr < 0x8000) {
+            addr %= 0x2000;
+            if (Board::hasPRGRAM && addr < this->cartridge->prgRAM.size())
+                this->cartridge->prgRAM.write(addr, data);
+        } else {
+            this->writeRegister(addr, data);
+            this->mapBanks();
+        }
     }
 };
 
 
-class NROM : public UxROM {
-    using UxROM::UxROM;
+// https://www.nesdev.org/wiki/NROM
+struct NROMBoard {
+    static constexpr std::array prg = {
+            BankWindow{.start = 0x8000, .size = 0x8000}, // 16 KB ROMs are mirrored
+    };
+    static constexpr std::array chr = {
+            BankWindow{.start = 0x0000, .size = 0x2000},
+    };
+    static constexpr bool hasPRGRAM = false;
+};
 
+class NROM : public BankedMapper<NROMBoard> {
 public:
-    void Write(nes::Address addr, nes::Byte data) override {
-        if (addr < 0x2000)
-            this->cartridge->chrROM[addr % 0x2000] = data;
+    using BankedMapper::BankedMapper;
+
+    std::unique_ptr<Mapper> Clone() const override {
+        return cloneMapper(*this);
+    }
+
+protected:
+    // no registers, writes to ROM are ignored
+    void writeRegister(Address, Byte) override {
     }
 };
 
 
-// https://www.nesdev.org/wiki/MMC1
-class MMC1 : public Mapper {
-private:
-    using PrgBankMode = enum : uint8_t {
-        switch32KBBank          = 0,
-        switch32KBBankAlt       = 1,
-        fixFirstAndSwitchSecond = 2,
-        fixSecondAndSwitchFirst = 3,
+// https://www.nesdev.org/wiki/UxROM
+struct UxROMBoard {
+    static constexpr std::array prg = {
+            BankWindow{.start = 0x8000, .size = 0x4000, .switchable = true},
+            BankWindow{.start = 0xC000, .size = 0x4000, .fixedBank = -1},
+    };
+    static constexpr std::array chr = {
+            BankWindow{.start = 0x0000, .size = 0x2000},
     };
+    static constexpr bool hasPRGRAM = false;
+};
 
-    Byte chrBanks[2];
-    Byte prgBank            = 0;
+class UxROM : public BankedMapper<UxROMBoard> {
+public:
+    using BankedMapper::BankedMapper;
 
-    size_t firstProgOffset  = 0x0000;
-    size_t secondProgOffset = 0x0000;
-    size_t firstCHROffset   = 0x0000;
-    size_t secondCHROffset  = 0x0000;
+    std::unique_ptr<Mapper> Clone() const override {
+        return cloneMapper(*this);
+    }
 
-    Byte shiftReg           = 0x20;
-    PrgBankMode prgBankMode = switch32KBBank;
-    bool chrSplitBanks      = false;
+protected:
+    void writeRegister(Address, Byte data) override {
+        // 7  bit  0
+        // ---- ----
+        // xxxx pPPP
+        //      ||||
+        //      ++++- Select 16 KB PRG ROM bank for CPU $8000-$BFFF
+        //           (UNROM uses bits 2-0; UOROM uses bits 3-0)
+        this->prgBanks[0] = data & 0x0f;
+    }
+};
 
+
+// https://www.nesdev.org/wiki/MMC1
+struct MMC1Board {
+    static constexpr std::array prg = {
+            BankWindow{.start = 0x8000, .size = 0x4000, .switchable = true},
+            BankWindow{.start = 0xC000, .size = 0x4000, .switchable = true},
+    };
+    static constexpr std::array chr = {
+            BankWindow{.start = 0x0000, .size = 0x1000, .switchable = true},
+            BankWindow{.start = 0x1000, .size = 0x1000, .switchable = true},
+    };
+    static constexpr bool hasPRGRAM = true;
+};
+
+class MMC1 : public BankedMapper<MMC1Board> {
 private:
-    void updateRegister(Address addr, Byte data) {
-        if (addr < 0xA000) {
-            // https://www.nesdev.org/wiki/MMC1#Control_(internal,_$8000-$9FFF)
-            this->chrSplitBanks = data & 0x10;
-            this->prgBankMode   = PrgBankMode((data >> 2) & 3);
-
-            switch (data & 0x3) {
-                case 0:
-                    this->cartridge->mirroringMode = Cartridge::MirroringMode::SingleScreenLowerBank;
-                    break;
-                case 1:
-                    this->cartridge->mirroringMode = Cartridge::MirroringMode::SingleScreenUpperBank;
-                    break;
-                case 2:
-                    this->cartridge->mirroringMode = Cartridge::MirroringMode::Vertical;
-                    break;
-                case 3:
-                    this->cartridge->mirroringMode = Cartridge::MirroringMode::Horizontal;
-                    break;
-            }
-        } else if (addr < 0xC000) {
-            // https://www.nesdev.org/wiki/MMC1#CHR_bank_0_(internal,_$A000-$BFFF)
-            this->chrBanks[0] = data;
-        } else if (addr < 0xF000) {
-            // https://www.nesdev.org/wiki/MMC1#CHR_bank_1_(internal,_$C000-$DFFF)
-            this->chrBanks[1] = data;
-        } else {
-            // https://www.nesdev.org/wiki/MMC1#PRG_bank_(internal,_$E000-$FFFF)
-            this->prgBank = data & 0xF;
+    Byte shiftReg   = 0;
+    Byte shiftCount = 0;
+
+    Byte control = 0x0C; // fix the last bank at $C000 on power on
+    Byte chrBank0 = 0;
+    Byte chrBank1 = 0;
+    Byte prgBank  = 0;
+
+    void selectBanks() {
+        // https://www.nesdev.org/wiki/MMC1#Control_(internal,_$8000-$9FFF)
+        switch (this->control & 0x3) {
+            case 0:
+                this->cartridge->mirroringMode = Cartridge::MirroringMode::SingleScreenLowerBank;
+                break;
+            case 1:
+                this->cartridge->mirroringMode = Cartridge::MirroringMode::SingleScreenUpperBank;
+                break;
+            case 2:
+                this->cartridge->mirroringMode = Cartridge::MirroringMode::Vertical;
+                break;
+            case 3:
+                this->cartridge->mirroringMode = Cartridge::MirroringMode::Horizontal;
+                break;
         }
 
-        // compute the new offsets so read/write ops are faster
-        switch (this->prgBankMode) {
-            case switch32KBBank:
-            case switch32KBBankAlt:
+        switch ((this->control >> 2) & 0x3) {
+            case 0:
+            case 1:
                 // switch 32 KB at $8000, ignoring low bit of bank number
-                this->firstProgOffset  = size_t(this->prgBank & 0xE) << 15;
-                this->secondProgOffset = this->firstProgOffset + 0x4000;
+                this->prgBanks = {this->prgBank & 0xE, this->prgBank | 0x1};
                 break;
-            case fixFirstAndSwitchSecond:
+            case 2:
                 // fix first bank at $8000 and switch 16 KB bank at $C000
-                this->firstProgOffset  = 0;
-                this->secondProgOffset = size_t(this->prgBank & 0xF) << 14;
+                this->prgBanks = {0, this->prgBank};
                 break;
-            case fixSecondAndSwitchFirst:
+            case 3:
                 // fix last bank at $C000 and switch 16 KB bank at $8000
-                this->firstProgOffset  = size_t(this->prgBank & 0xF) << 14;
-                this->secondProgOffset = (this->cartridge->prgROM.size() - 1) & ~(0x3fff);
+                this->prgBanks = {this->prgBank, -1};
                 break;
         }
 
-
-        if (this->chrSplitBanks) {
-            this->firstCHROffset  = size_t(this->chrBanks[0]) << 12;
-            this->secondCHROffset = size_t(this->chrBanks[1]) << 12;
+        if (this->control & 0x10) {
+            // switch two separate 4 KB banks
+            this->chrBanks = {this->chrBank0, this->chrBank1};
         } else {
-            this->firstCHROffset  = size_t(this->chrBanks[0]) << 12;
-            this->secondCHROffset = this->firstCHROffset + 0x1000;
+            // switch 8 KB at a time, ignoring low bit of bank number
+            this->chrBanks = {this->chrBank0 & 0x1E, this->chrBank0 | 0x1};
         }
     }
 
-public:
-    MMC1(PCartridge &&c) :
-        Mapper(std::move(c)) {
-        this->firstProgOffset  = 0;
-        this->secondProgOffset = (this->cartridge->prgROM.size() - 1) & ~0x3fff;
-    }
+protected:
+    void writeRegister(Address addr, Byte data) override {
+        // https://www.nesdev.org/wiki/MMC1#Load_register_($8000-$FFFF)
+        // 7  bit  0
+        // ---- ----
+        // Rxxx xxxD
+        // |       |
+        // |       +- Data bit to be shifted into shift register, LSB first
+        // +--------- 1: Reset shift register and write Control with (Control OR $0C),
+        //               locking PRG ROM at $C000-$FFFF to the last bank.
+        if (data & 0x80) {
+            this->shiftReg   = 0;
+            this->shiftCount = 0;
+            this->control |= 0x0C;
+            this->selectBanks();
+            return;
+        }
 
-    const Byte *DMAStart(nes::Address addr) const override {
-        if (addr < 0x1000)
-            return &this->cartridge->chrROM[this->firstCHROffset | (addr & 0xfff)];
-        else if (addr < 0x2000)
-            return &this->cartridge->chrROM[this->secondProgOffset | (addr & 0xfff)];
-        else if (addr < 0x6000)
-            return nullptr;
-        else if (addr < 0x8000)
-            // CPU $6000-$7FFF: 8 KB PRG RAM bank, (optional)
-            if (!this->cartridge->prgRAM.empty())
-                return &this->cartridge->prgRAM[addr];
-            else
-                return nullptr;
-        else if (addr < 0xC000)
-            // CPU $8000-$BFFF: 16 KB PRG ROM bank, either switchable or fixed to the first bank
-            return &this->cartridge->prgROM[this->firstProgOffset | (addr % 0x4000)];
-        else
-            // CPU $C000-$FFFF: 16 KB PRG ROM bank, either fixed to the last bank or switchable
-            return &this->cartridge->prgROM[this->secondProgOffset | (addr % 0x4000)];
+        this->shiftReg |= (data & 0x1) << this->shiftCount;
+        if (++this->shiftCount < 5)
+            return;
+
+        // the fifth write picks the register by its address
+        switch ((addr >> 13) & 0x3) {
+            case 0:
+                this->control = this->shiftReg;
+                break;
+            case 1:
+                // https://www.nesdev.org/wiki/MMC1#CHR_bank_0_(internal,_$A000-$BFFF)
+                this->chrBank0 = this->shiftReg;
+                break;
+            case 2:
+                // https://www.nesdev.org/wiki/MMC1#CHR_bank_1_(internal,_$C000-$DFFF)
+                this->chrBank1 = this->shiftReg;
+                break;
+            case 3:
+                // https://www.nesdev.org/wiki/MMC1#PRG_bank_(internal,_$E000-$FFFF)
+                this->prgBank = this->shiftReg & 0xF;
+                break;
+        }
+
+        this->shiftReg   = 0;
+        this->shiftCount = 0;
+        this->selectBanks();
     }
 
-    Byte Read(nes::Address addr) const override {
-        if (addr < 0x1000)
-            return this->cartridge->chrROM[this->firstCHROffset | (addr & 0xfff)];
-        else if (addr < 0x2000)
-            return this->cartridge->chrROM[this->secondProgOffset | (addr & 0xfff)];
-        else if (addr < 0x6000)
-            return 0;
-        else if (addr < 0x8000)
-            // CPU $6000-$7FFF: 8 KB PRG RAM bank, (optional)
-            if (!this->cartridge->prgRAM.empty())
-                return this->cartridge->prgRAM[addr];
-            else
-                return 0;
-        else if (addr < 0xC000)
-            // CPU $8000-$BFFF: 16 KB PRG ROM bank, either switchable or fixed to the first bank
-            return this->cartridge->prgROM[this->firstProgOffset | (addr % 0x4000)];
-        else
-            // CPU $C000-$FFFF: 16 KB PRG ROM bank, either fixed to the last bank or switchable
-            return this->cartridge->prgROM[this->secondProgOffset | (addr % 0x4000)];
+public:
+    MMC1(PCartridge &&c) :
+        BankedMapper(std::move(c)) {
+        this->selectBanks();
+        this->mapBanks();
     }
 
-    void Write(nes::Address addr, Byte data) override {
-        if (addr < 0x1000)
-            this->cartridge->chrROM[this->firstCHROffset | (addr & 0xfff)] = data;
-        else if (addr < 0x2000)
-            this->cartridge->chrROM[this->secondCHROffset | (addr & 0xfff)] = data;
-        else if (addr < 0x6000)
-            return;
-        else if (addr < 0x8000) {
-            // CPU $6000-$7FFF: 8 KB PRG RAM bank, (optional)
-            if (!this->cartridge->prgRAM.empty())
-                this->cartridge->prgRAM[addr] = data;
-        } else {
-            if (data & 0x80) {
-                //  7  bit  0
-                // ---- ----
-                // Rxxx xxxD
-                // |       |
-                // |       +- Data bit to be shifted into shift register, LSB first
-                // +--------- 1: Reset shift register and write Control with (Control OR $0C),
-                //               locking PRG ROM at $C000-$FFFF to the last bank.
-
-                this->shiftReg = 0x20; // after five shifts will be in bit 1
-            } else {
-                // bits are shifted to the *right* because the LSB is added first
-                this->shiftReg = (this->shiftReg >> 1) | ((data & 0x1) << 5);
-
-                if (this->shiftReg & 0x1) {
-                    this->updateRegister(addr, this->shiftReg >> 1);
-
-                    // reset it back to the initial state, waiting for 5 shifts
-                    this->shiftReg = 0x02;
-                }
-            }
-        }
+    std::unique_ptr<Mapper> Clone() const override {
+        return cloneMapper(*this);
     }
 };
 
 
 // https://www.nesdev.org/wiki/MMC3
-class MMC3 : public Mapper {
+struct MMC3Board {
+    // PRG windows 0 and 2 swap banks with the PRG ROM bank mode
+    static constexpr std::array prg = {
+            BankWindow{.start = 0x8000, .size = 0x2000, .switchable = true},
+            BankWindow{.start = 0xA000, .size = 0x2000, .switchable = true},
+            BankWindow{.start = 0xC000, .size = 0x2000, .switchable = true},
+            BankWindow{.start = 0xE000, .size = 0x2000, .fixedBank = -1},
+    };
 
+    // the 2 KB banks are two 1 KB windows each, so that the CHR A12 inversion only swaps banks around
+    static constexpr std::array chr = {
+            BankWindow{.start = 0x0000, .size = 0x0400, .switchable = true},
+            BankWindow{.start = 0x0400, .size = 0x0400, .switchable = true},
+            BankWindow{.start = 0x0800, .size = 0x0400, .switchable = true},
+            BankWindow{.start = 0x0C00, .size = 0x0400, .switchable = true},
+            BankWindow{.start = 0x1000, .size = 0x0400, .switchable = true},
+            BankWindow{.start = 0x1400, .size = 0x0400, .switchable = true},
+            BankWindow{.start = 0x1800, .size = 0x0400, .switchable = true},
+            BankWindow{.start = 0x1C00, .size = 0x0400, .switchable = true},
+    };
+    static constexpr bool hasPRGRAM = true;
+};
+
+class MMC3 : public BankedMapper<MMC3Board> {
 private:
-    std::array<Byte, 8> registers   = {0};
-    Byte registerSelect             = 0;
-    bool enableRAM                  = false;
-    bool enableWrites               = false;
-    bool enableIRQ                  = false;
-    bool invertCHR                  = false;
-    bool fixLowPRG                  = false;
-    Byte irqCounter                 = 0;
-    Byte irqPeriod                  = 0;
-    std::array<size_t, 8> chrBanks  = {0};
-    std::array<size_t, 4> prgBanks  = {0};
-
-    static const size_t prgBankSize = 0x2000;
-    static const size_t chrBankSize = 0x0400;
-
-    void updateBanks() {
-        // alignments in Cartridge already guaranteed
-
-        const size_t totalPRG = this->cartridge->prgROM.size() / prgBankSize;
-        const size_t totalCHR = this->cartridge->chrROM.size() / chrBankSize;
-
-        this->prgBanks[0]     = this->registers[6];
-        this->prgBanks[1]     = this->registers[7];
-        this->prgBanks[2]     = (totalPRG - 2);
-        this->prgBanks[3]     = (totalPRG - 1);
+    std::array<Byte, 8> registers = {0};
+    Byte registerSelect           = 0;
+    bool enableRAM                = false;
+    bool enableWrites             = false;
+    bool enableIRQ                = false;
+    bool invertCHR                = false;
+    bool fixLowPRG                = false;
+    Byte irqCounter               = 0;
+    Byte irqPeriod                = 0;
+
+    void selectBanks() {
+        // https://www.nesdev.org/wiki/MMC3#Banks
+        // CPU $8000-$9FFF (or $C000-$DFFF): 8 KB switchable PRG ROM bank
+        // CPU $A000-$BFFF: 8 KB switchable PRG ROM bank
+        // CPU $C000-$DFFF (or $8000-$9FFF): 8 KB PRG ROM bank, fixed to the second-last bank
+        // CPU $E000-$FFFF: 8 KB PRG ROM bank, fixed to the last bank
+        this->prgBanks[0] = this->registers[6];
+        this->prgBanks[1] = this->registers[7];
+        this->prgBanks[2] = -2;
 
         if (this->fixLowPRG)
             std::swap(this->prgBanks[0], this->prgBanks[2]);
 
-        this->chrBanks[0] = this->invertCHR ? this->registers[2] : this->registers[0] & ~0x1;
-        this->chrBanks[1] = this->invertCHR ? this->registers[3] : this->registers[0] | 0x1;
-        this->chrBanks[2] = this->invertCHR ? this->registers[4] : this->registers[1] & ~0x1;
-        this->chrBanks[3] = this->invertCHR ? this->registers[5] : this->registers[1] | 0x1;
-        this->chrBanks[4] = this->invertCHR ? this->registers[0] & ~0x1 : this->registers[2];
-        this->chrBanks[5] = this->invertCHR ? this->registers[0] | 0x1 : this->registers[3];
-        this->chrBanks[6] = this->invertCHR ? this->registers[1] & ~0x1 : this->registers[4];
-        this->chrBanks[7] = this->invertCHR ? this->registers[1] | 0x1 : this->registers[5];
-
-        for (auto &bank: this->prgBanks)
-            bank *= prgBankSize;
-
-        for (auto &bank: this->chrBanks)
-            bank *= chrBankSize;
-    }
-
-public:
-    MMC3(PCartridge &&c) :
-        Mapper(std::move(c)) {
-        updateBanks();
-    }
-
-
-    Byte Read(Address addr) const override {
-        // https://www.nesdev.org/wiki/MMC3#Banks
-
-        // PPU reads
-        if (addr < 0x2000) {
-            // PPU $0000-$07FF (or $1000-$17FF): 2 KB switchable CHR bank
-            // PPU $0800-$0FFF (or $1800-$1FFF): 2 KB switchable CHR bank
-            // PPU $1000-$13FF (or $0000-$03FF): 1 KB switchable CHR bank
-            // PPU $1400-$17FF (or $0400-$07FF): 1 KB switchable CHR bank
-            // PPU $1800-$1BFF (or $0800-$0BFF): 1 KB switchable CHR bank
-            // PPU $1C00-$1FFF (or $0C00-$0FFF): 1 KB switchable CHR bank
-            const size_t bank      = addr / chrBankSize;
-            const size_t offset    = addr % chrBankSize;
-            const size_t chrOffset = this->chrBanks[bank] | offset;
-
-            if (chrOffset < this->cartridge->chrROM.size())
-                return this->cartridge->chrROM[chrOffset];
-        } else if (addr < 0x6000) {
-            // not mapped to PPU or CPU
-            return 0;
-        } else if (addr < 0x8000) {
-            // CPU $6000-$7FFF: 8 KB PRG RAM bank (optional)
-            addr %= 0x2000;
-            if (addr < this->cartridge->prgRAM.size())
-                return this->cartridge->prgRAM[addr];
-        } else {
-            // CPU $8000-$9FFF (or $C000-$DFFF): 8 KB switchable PRG ROM bank
-            // CPU $A000-$BFFF: 8 KB switchable PRG ROM bank
-            // CPU $C000-$DFFF (or $8000-$9FFF): 8 KB PRG ROM bank, fixed to the second-last bank
-            // CPU $E000-$FFFF: 8 KB PRG ROM bank, fixed to the last bank
-            const size_t bank      = (addr & ~0x8000) / prgBankSize;
-            const size_t offset    = addr % prgBankSize;
-            const size_t prgOffset = this->prgBanks[bank] | offset;
-
-            if (prgOffset < this->cartridge->prgROM.size())
-                return this->cartridge->prgROM[prgOffset];
-        }
-
-        return 0;
+        // PPU $0000-$07FF (or $1000-$17FF): 2 KB switchable CHR bank
+        // PPU $0800-$0FFF (or $1800-$1FFF): 2 KB switchable CHR bank
+        // PPU $1000-$13FF (or $0000-$03FF): 1 KB switchable CHR bank
+        // PPU $1400-$17FF (or $0400-$07FF): 1 KB switchable CHR bank
+        // PPU $1800-$1BFF (or $0800-$0BFF): 1 KB switchable CHR bank
+        // PPU $1C00-$1FFF (or $0C00-$0FFF): 1 KB switchable CHR bank
+        const size_t low  = this->invertCHR ? 4 : 0;
+        const size_t high = this->invertCHR ? 0 : 4;
+
+        this->chrBanks[low + 0]  = this->registers[0] & ~0x1;
+        this->chrBanks[low + 1]  = this->registers[0] | 0x1;
+        this->chrBanks[low + 2]  = this->registers[1] & ~0x1;
+        this->chrBanks[low + 3]  = this->registers[1] | 0x1;
+        this->chrBanks[high + 0] = this->registers[2];
+        this->chrBanks[high + 1] = this->registers[3];
+        this->chrBanks[high + 2] = this->registers[4];
+        this->chrBanks[high + 3] = this->registers[5];
     }
 
-    const Byte *DMAStart(Address addr) const override {
-        // PPU reads
-        if (addr < 0x2000) {
-            // PPU $0000-$07FF (or $1000-$17FF): 2 KB switchable CHR bank
-            // PPU $0800-$0FFF (or $1800-$1FFF): 2 KB switchable CHR bank
-            // PPU $1000-$13FF (or $0000-$03FF): 1 KB switchable CHR bank
-            // PPU $1400-$17FF (or $0400-$07FF): 1 KB switchable CHR bank
-            // PPU $1800-$1BFF (or $0800-$0BFF): 1 KB switchable CHR bank
-            // PPU $1C00-$1FFF (or $0C00-$0FFF): 1 KB switchable CHR bank
-            const size_t bank      = addr / chrBankSize;
-            const size_t offset    = addr % chrBankSize;
-            const size_t chrOffset = this->chrBanks[bank] | offset;
-
-            if (chrOffset + 256 <= this->cartridge->chrROM.size())
-                return &this->cartridge->chrROM[chrOffset];
-        } else if (addr < 0x6000) {
-            // not mapped to PPU or CPU
-            return 0;
-        } else if (addr < 0x8000) {
-            // CPU $6000-$7FFF: 8 KB PRG RAM bank (optional)
-            addr %= 0x2000;
-            if (addr + 256 < this->cartridge->prgRAM.size())
-                return &this->cartridge->prgRAM[addr];
-        } else {
-            // CPU $8000-$9FFF (or $C000-$DFFF): 8 KB switchable PRG ROM bank
-            // CPU $A000-$BFFF: 8 KB switchable PRG ROM bank
-            // CPU $C000-$DFFF (or $8000-$9FFF): 8 KB PRG ROM bank, fixed to the second-last bank
-            // CPU $E000-$FFFF: 8 KB PRG ROM bank, fixed to the last bank
-            const size_t bank      = (addr & ~0x8000) / prgBankSize;
-            const size_t offset    = addr % prgBankSize;
-            const size_t prgOffset = this->prgBanks[bank] | offset;
-
-            if (prgOffset + 256 <= this->cartridge->prgROM.size())
-                return &this->cartridge->prgROM[prgOffset];
-        }
-
-        return nullptr;
-    }
-
-    void Write(Address addr, Byte data) override {
-        // PPU reads
-        if (addr < 0x2000) {
-            // PPU $0000-$07FF (or $1000-$17FF): 2 KB switchable CHR bank
-            // PPU $0800-$0FFF (or $1800-$1FFF): 2 KB switchable CHR bank
-            // PPU $1000-$13FF (or $0000-$03FF): 1 KB switchable CHR bank
-            // PPU $1400-$17FF (or $0400-$07FF): 1 KB switchable CHR bank
-            // PPU $1800-$1BFF (or $0800-$0BFF): 1 KB switchable CHR bank
-            // PPU $1C00-$1FFF (or $0C00-$0FFF): 1 KB switchable CHR bank
-            const size_t bank      = addr / chrBankSize;
-            const size_t offset    = addr % chrBankSize;
-            const size_t chrOffset = this->chrBanks[bank] | offset;
-
-            if (chrOffset < this->cartridge->chrROM.size())
-                this->cartridge->chrROM[chrOffset] = data;
-        } else if (addr < 0x6000) {
-            // probably unmapped?
-            return;
-        } else if (addr < 0x8000) {
-            // CPU $6000-$7FFF: 8 KB PRG RAM bank (optional)
-            addr %= 0x2000;
-            if (addr < this->cartridge->prgRAM.size())
-                this->cartridge->prgRAM[addr] = data;
-        } else if (addr < 0xa000 && addr & 1) {
+protected:
+    void writeRegister(Address addr, Byte data) override {
+        if (addr < 0xa000 && addr & 1) {
             // Bank data ($8001-$9FFF, odd)
             this->registers[this->registerSelect] = data;
-
-            this->updateBanks();
+            this->selectBanks();
         } else if (addr < 0xa000 && ~addr & 1) {
             // Bank select ($8000-$9FFE, even)
             this->registerSelect = data & 0x7;
             this->fixLowPRG      = data & 0x40;
             this->invertCHR      = data & 0x80;
-
-            this->updateBanks();
+            this->selectBanks();
         } else if (addr < 0xc000 && addr & 1) {
             // PRG RAM protect ($A001-$BFFF, odd)
             this->enableRAM    = data & 0x40;
@@ -442,13 +526,22 @@ public:
         }
     }
 
-    void OnScanline() override {
+public:
+    MMC3(PCartridge &&c) :
+        BankedMapper(std::move(c)) {
+        this->selectBanks();
+        this->mapBanks();
+    }
+
+    std::unique_ptr<Mapper> Clone() const override {
+        return cloneMapper(*this);
+    }
+
+    bool OnScanline() override {
         this->irqCounter = (this->irqCounter == 0) ? this->irqPeriod : this->irqCounter - 1;
 
-        if (this->enableIRQ && this->irqCounter == 0) {
-            // send an IRQ to the CPU
-            this->triggerIRQ();
-        }
+        // send an IRQ to the CPU
+        return this->enableIRQ && this->irqCounter == 0;
     }
 };
 
@@ -456,8 +549,8 @@ std::unique_ptr<Mapper> Mapper::Create(MapperType mapperType, PCartridge &&cart)
     switch (mapperType) {
         case MapperType::INESMapper000:
             return std::make_unique<NROM>(std::move(cart));
-            //        case MapperType::INESMapper001:
-            //            return std::make_unique<MMC1>(std::move(cart));
+        case MapperType::INESMapper001:
+            return std::make_unique<MMC1>(std::move(cart));
         case MapperType::INESMapper002:
             return std::make_unique<UxROM>(std::move(cart));
         case MapperType::INESMapper004:
@@ -469,4 +562,16 @@ std::unique_ptr<Mapper> Mapper::Create(MapperType mapperType, PCartridge &&cart)
     throw std::runtime_error(std::string("Unknown mapper type: ").append(std::to_string(uint8_t(mapperType))));
 }
 
-} // namespace nes
\ No newline at end of file
+bool Mapper::IsSupported(MapperType mapperType) {
+    switch (mapperType) {
+        case MapperType::INESMapper000:
+        case MapperType::INESMapper001:
+        case MapperType::INESMapper002:
+        case MapperType::INESMapper004:
+            return true;
+        default:
+            return false;
+    }
+}
+
+} // namespace nes
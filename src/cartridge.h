@@ -1,26 +1,127 @@
 #pragma once
 #include "nes.h"
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
 
 namespace nes {
 
+class RomImage;
+class SaveFile;
+
+// RAM in 1 KB pages which copies share until one of them writes to a page, which then gets a copy of its own.
+// Cloned consoles only pay for the pages they change.
+//
+// Which pages can be written in place is tracked by each copy on its own, rather than from the pages' use counts,
+// so copies can run on different threads. Copying needs the original to be paused, as for the rest of a console.
+class PagedRAM {
+public:
+    static const size_t PAGE_SIZE = 0x400;
+    using Page                    = std::array<Byte, PAGE_SIZE>;
+
+private:
+    std::vector<std::shared_ptr<Page>> pages;
+    mutable std::vector<bool> ownedPages; // written in place, as no copy has them. Copying gives them up.
+    size_t bytes = 0;
+    std::shared_ptr<void> owner; // of the memory the pages were mapped onto
+
+public:
+    PagedRAM() = default;
+    PagedRAM(const PagedRAM &other);
+    PagedRAM &operator=(const PagedRAM &) = delete;
+
+    // zero filled
+    void resize(size_t size);
+
+    size_t size() const {
+        return this->bytes;
+    }
+
+    bool empty() const {
+        return this->bytes == 0;
+    }
+
+    Byte read(size_t offset) const {
+        return (*this->pages[offset / PAGE_SIZE])[offset % PAGE_SIZE];
+    }
+
+    // the page holding offset, until a write to it returns true
+    const Byte *page(size_t offset) const {
+        return this->pages[offset / PAGE_SIZE]->data();
+    }
+
+    // returns true when the page was shared and moved to a copy
+    bool write(size_t offset, Byte data) {
+        const size_t index = offset / PAGE_SIZE;
+        auto &page         = this->pages[index];
+        const bool shared  = !this->ownedPages[index];
+        if (shared) {
+            page                    = std::make_shared<Page>(*page);
+            this->ownedPages[index] = true;
+        }
+
+        (*page)[offset % PAGE_SIZE] = data;
+        return shared;
+    }
+
+    // Use memory kept alive by owner as the pages, such as a save file, in place of their contents.
+    // Copies get pages of their own, so that only this RAM writes to it.
+    void mapOnto(std::span<Byte> memory, std::shared_ptr<void> owner);
+};
+
 struct Cartridge {
+    static const size_t PRG_PAGE_SIZE = 0x2000;
+    static const size_t CHR_PAGE_SIZE = 0x0400;
+
     enum class MirroringMode {
         Horizontal            = 0,
         Vertical              = 1,
         SingleScreenLowerBank = 2,
         FourScreen            = 3,
-        SingleScreenUpperBank = 2,
+        SingleScreenUpperBank = 4, // only set by mappers, never in a header or ROM cache
     };
 
-    std::vector<Byte> prgROM; // multiple of 16 KiB / 0x4000
-    std::vector<Byte> chrROM; // multiple of 8 KiB  / 0x2000
-    std::vector<Byte> prgRAM; // multiple of 8 KiB  / 0x2000
+    // ROM is a read-only view into an image shared by every cartridge of the same file
+    std::shared_ptr<const RomImage> image;
+    std::span<const Byte> prgROM; // multiple of 16 KiB / 0x4000
+    std::span<const Byte> chrROM; // multiple of 8 KiB  / 0x2000, empty on boards with CHR RAM
+    size_t prgFileOffset = 16;    // where PRG ROM starts in the iNES file, for patches made against it
+
+    // patched copies of ROM pages, by their offset in PRG/CHR ROM. Mapped instead of the ROM.
+    std::map<size_t, std::vector<Byte>> prgPatches;
+    std::map<size_t, std::vector<Byte>> chrPatches;
+
+    // RAM is per console, and shared page by page with its clones until written
+    PagedRAM chrRAM;
+    PagedRAM prgRAM; // multiple of 8 KiB  / 0x2000, mapped onto the save file if there is one
     std::vector<Byte> sRAM;
     MirroringMode mirroringMode;
+
+    // PRG RAM is kept by a battery, and can be mapped onto a save file
+    bool hasBattery = false;
+    std::shared_ptr<SaveFile> save;
+
+    // of CHR ROM or RAM, whichever the board has
+    size_t chrSize() const {
+        return this->chrRAM.empty() ? this->chrROM.size() : this->chrRAM.size();
+    }
+
+    // only boards with CHR RAM take writes. Returns true when the page moved and has to be mapped again.
+    bool writeCHR(size_t offset, Byte data) {
+        return offset < this->chrRAM.size() && this->chrRAM.write(offset, data);
+    }
 };
 
 using PCartridge = std::unique_ptr<Cartridge>;
 
+// https://www.nesdev.org/wiki/Game_Genie
+struct GameGenieCode {
+    Address addr;
+    Byte value;
+    std::optional<Byte> compare; // 8 letter codes only replace this value
+};
+
 enum class MapperType : uint16_t {
     INESMapper000 = 0,
     INESMapper001 = 1,
@@ -30,24 +131,65 @@ enum class MapperType : uint16_t {
 
 class Mapper {
 private:
-    bool pendingIRQ = false;
+    // CPU $8000-$FFFF in 8 KB pages, nullptr where the ROM has no bank to map
+    std::array<const Byte *, 4> prgPages = {nullptr};
+    // PPU $0000-$1FFF in 1 KB pages, nullptr where fetches have to go through Read
+    std::array<const Byte *, 8> chrPages = {nullptr};
+
+    // PRG pages with Game Genie codes applied, by their offset in PRG ROM and the CPU page they're mapped at.
+    // Empty where no code applies.
+    std::vector<GameGenieCode> gameGenieCodes;
+    std::map<std::pair<size_t, size_t>, std::vector<Byte>> gameGeniePages;
 
 protected:
-    void triggerIRQ();
+    // map a 1 KB CHR page to an offset in CHR ROM/RAM, call whenever the banks change.
+    // Mappers with side effects on PPU fetches should leave their pages unmapped.
+    void mapCHR(size_t page, size_t offset);
+
+    // map the 8 KB PRG page at offset to CPU $8000 + cpuPage * 8 KB, patched or not
+    void mapPRG(size_t cpuPage, size_t offset);
+
+    // point every page at its bank again
+    virtual void mapBanks() = 0;
+
+    // with a cartridge of its own, sharing the RAM pages. Clones map their banks again afterwards.
+    Mapper(const Mapper &other);
 
 public:
     PCartridge cartridge;
 
     Mapper(PCartridge &&c);
     virtual ~Mapper() = default;
-    bool CheckIRQ();
+
+    // the board in the same state, for a cloned console
+    virtual std::unique_ptr<Mapper> Clone() const = 0;
+
+    // the memory behind a CPU address in $8000-$FFFF, or nullptr if it reads as 0
+    const Byte *PRGPage(Address addr) const {
+        return this->prgPages[(addr - 0x8000) >> 13];
+    }
+
+    // the memory behind a PPU pattern table address, or nullptr if it must be read through Read
+    const Byte *CHRPage(Address addr) const {
+        return this->chrPages[addr >> 10];
+    }
 
     virtual Byte Read(Address addr) const            = 0;
     virtual const Byte *DMAStart(Address addr) const = 0;
     virtual void Write(Address addr, Byte data)      = 0;
-    virtual void OnScanline();
+
+    // clocked by the PPU once per rendered line, returns true to raise an IRQ on the CPU
+    virtual bool OnScanline();
+
+    // Patch what the CPU reads at an address in $8000-$FFFF. Codes with a compare value only patch banks that
+    // hold it there. Reads cost the same: the patched pages are copies that replace the ROM in the page tables.
+    void AddGameGenieCode(const GameGenieCode &code);
+
+    // map the banks again after patching the cartridge's ROM pages
+    void Remap();
 
     static std::unique_ptr<Mapper> Create(MapperType mapperType, PCartridge &&cart);
+    static bool IsSupported(MapperType mapperType);
 };
 
 }; // namespace nes
@@ -1,7 +1,10 @@
 #include "console.h"
 #include "apu.h"
 #include "cpu.h"
+#include "patch.h"
 #include "ppu.h"
+#include "savefile.h"
+#include <cstring>
 
 namespace nes {
 
@@ -9,6 +12,12 @@ Console::Console(std::unique_ptr<Mapper> &&m) :
     mapper(std::move(m)) {
 }
 
+Console::~Console() {
+    // the audio worker calls back into the console
+    if (this->apu)
+        this->apu->setAudioThread(false);
+}
+
 std::shared_ptr<Console> Console::Create(std::unique_ptr<Mapper> &&m) {
     std::shared_ptr<Console> console(new Console(std::move(m)));
 
@@ -16,68 +25,191 @@ std::shared_ptr<Console> Console::Create(std::unique_ptr<Mapper> &&m) {
     console->ppu = std::make_unique<PPU>(*console);
     console->cpu = std::make_unique<CPU>(*console);
 
-    console->apu->registerAudioCallback(std::bind(&Console::bufferAudioSample, console.get(), std::placeholders::_1));
     return console;
 }
 
+std::shared_ptr<Console> Console::Clone() {
+    std::shared_ptr<Console> clone(new Console(this->mapper->Clone()));
+    clone->controller = this->controller;
+    clone->cycles     = this->cycles;
+
+    clone->apu = std::make_unique<APU>(*clone);
+    clone->ppu = std::make_unique<PPU>(*clone);
+    clone->cpu = std::make_unique<CPU>(*clone);
+
+    clone->apu->copyFrom(*this->apu);
+    clone->ppu->copyFrom(*this->ppu);
+    clone->cpu->copyFrom(*this->cpu);
+
+    return clone;
+}
+
 void Console::StepFrame() {
     uint64_t prevFrame = this->ppu->currentFrame();
 
     while (prevFrame == this->ppu->currentFrame()) {
         auto numCycles = this->cpu->step();
-        for (auto cycle = 0; cycle < numCycles; cycle++) {
-            this->apu->step();
+        this->cycles += numCycles;
 
-            this->ppu->step();
-            this->ppu->step();
-            this->ppu->step();
+        // the APU catches up by itself on register accesses, so only frame IRQs and audio blocks are left
+        if (this->cycles > this->apu->nextSyncCycle())
+            this->apu->runUntil(this->cycles);
 
-            if (this->mapper->CheckIRQ()) {
-                this->cpu->interrupt(Interrupt::IRQ);
-            }
-        }
+        // mapper IRQs are raised by the PPU as it clocks the scanline counter, nothing to poll per cycle.
+        // OAM DMA stalls come in as one step of over 500 cycles, mostly spent in vblank.
+        this->ppu->run(3 * numCycles);
     }
+
+    this->apu->endFrame();
 }
 
 
-void Console::DrawFrame(SDL_Surface *surface, uint8_t scaling) const {
-    auto pixels  = static_cast<uint32_t *>(surface->pixels);
-    auto format  = surface->format;
+void Console::ConvertFrame(const PixelConverter &converter, void *pixels, size_t pitch) const {
     auto &screen = this->ppu->completedScreen();
+    auto rows    = static_cast<Byte *>(pixels);
 
-    for (auto y = 0; y < this->ppu->SCREEN_HEIGHT; y++) {
-        for (auto x = 0; x < this->ppu->SCREEN_WIDTH; x++) {
-            auto pixelRGBA = screen[y][x];
-
-            for (int drawY = y * scaling; drawY < (y + 1) * scaling; drawY++) {
-                for (int drawX = x * scaling; drawX < (x + 1) * scaling; drawX++) {
-                    auto pixelIndex    = drawY * this->ppu->SCREEN_WIDTH * scaling + drawX;
-                    pixels[pixelIndex] = SDL_MapRGBA(format, uint8_t(pixelRGBA >> 16), uint8_t(pixelRGBA >> 8),
-                                                     uint8_t(pixelRGBA), 0xff);
-                }
-            }
+    for (auto y = 0; y < PPU::SCREEN_HEIGHT; y++)
+        converter.convert(screen[y], PPU::SCREEN_WIDTH, rows + y * pitch);
+}
+
+void Console::DrawFrame(SDL_Surface *surface, uint8_t scaling) const {
+    auto rows  = static_cast<Byte *>(surface->pixels);
+    auto pitch = size_t(surface->pitch);
+
+    std::optional<PixelFormat> pixelFormat;
+    switch (surface->format->format) {
+        case SDL_PIXELFORMAT_RGBA8888:
+            pixelFormat = PixelFormat::RGBA8888;
+            break;
+        case SDL_PIXELFORMAT_BGRA8888:
+            pixelFormat = PixelFormat::BGRA8888;
+            break;
+        case SDL_PIXELFORMAT_ARGB8888:
+        case SDL_PIXELFORMAT_RGB888:
+            pixelFormat = PixelFormat::ARGB8888;
+            break;
+        case SDL_PIXELFORMAT_RGB565:
+            pixelFormat = PixelFormat::RGB565;
+            break;
+        case SDL_PIXELFORMAT_RGB24:
+            pixelFormat = PixelFormat::RGB24;
+            break;
+    }
+
+    if (!pixelFormat) {
+        // any other 32-bit format: let SDL map each palette entry once
+        std::array<uint32_t, 512> mapped;
+        for (size_t index = 0; index < mapped.size(); index++) {
+            auto rgb      = PaletteRGB(index);
+            mapped[index] = SDL_MapRGBA(surface->format, uint8_t(rgb >> 16), uint8_t(rgb >> 8), uint8_t(rgb), 0xff);
+        }
+
+        auto &screen = this->ppu->completedScreen();
+        for (auto y = 0; y < PPU::SCREEN_HEIGHT * scaling; y++) {
+            auto row = reinterpret_cast<uint32_t *>(rows + y * pitch);
+            for (auto x = 0; x < PPU::SCREEN_WIDTH * scaling; x++)
+                row[x] = mapped[screen[y / scaling][x / scaling] & 0x1ff];
         }
+        return;
+    }
+
+    PixelConverter converter(*pixelFormat);
+    if (scaling == 1) {
+        this->ConvertFrame(converter, rows, pitch);
+        return;
     }
+
+    // convert each line into the first row of its block, widen it in place, then copy it down
+    const size_t bytesPerPixel = converter.bytesPerPixel();
+    auto &screen               = this->ppu->completedScreen();
+    for (auto y = 0; y < PPU::SCREEN_HEIGHT; y++) {
+        auto row = rows + y * scaling * pitch;
+        converter.convert(screen[y], PPU::SCREEN_WIDTH, row);
+
+        for (auto x = PPU::SCREEN_WIDTH - 1; x >= 0; x--)
+            for (auto copy = scaling - 1; copy >= 0; copy--)
+                std::memmove(row + (x * scaling + copy) * bytesPerPixel, row + x * bytesPerPixel, bytesPerPixel);
+
+        for (auto copy = 1; copy < scaling; copy++)
+            std::memcpy(row + copy * pitch, row, PPU::SCREEN_WIDTH * scaling * bytesPerPixel);
+    }
+}
+
+void Console::WriteAudioFeatures(float *out) const {
+    std::memcpy(out, &this->apu->frameFeatures(), sizeof(AudioFeatures));
+}
+
+void Console::SetRenderThreads(size_t numThreads) {
+    this->ppu->setRenderThreads(numThreads);
+}
+
+void Console::SetAudioEnabled(bool enabled) {
+    this->apu->setAudioEnabled(enabled);
+}
+
+void Console::SetAudioThread(bool enabled) {
+    this->apu->setAudioThread(enabled);
+}
+
+bool Console::UseSaveFile(const std::string &path) {
+    auto &cartridge = *this->mapper->cartridge;
+    if (!cartridge.hasBattery)
+        return false;
+
+    // mappers look up PRG RAM pages on every access, so nothing holds on to the old ones
+    cartridge.save = SaveFile::Open(path, cartridge.prgRAM.size());
+    cartridge.prgRAM.mapOnto(cartridge.save->bytes(), cartridge.save);
+    return true;
+}
+
+void Console::AddGameGenieCode(const std::string &code) {
+    this->mapper->AddGameGenieCode(ParseGameGenieCode(code));
+}
+
+void Console::ApplyIPSPatch(const std::string &path) {
+    nes::ApplyIPSPatch(*this->mapper->cartridge, path);
+    this->mapper->Remap();
 }
 
 void Console::SetButton(Buttons button, bool status) {
     this->controller.buttons[uint8_t(button)] = status;
 }
 
-void Console::bufferAudioSample(float sample) {
-    this->bufferedAudio[this->samplePos] = sample;
-    this->samplePos++;
+void Console::SetAudioSink(AudioSink *sink) {
+    this->apu->setAudioSink(sink);
+}
 
-    if (this->samplePos == this->bufferedAudio.size()) {
-        this->samplePos = 0;
+void Console::RegisterAudioCallback(ProcessAudioSamples processSamplesFn) {
+    // the APU lets go of the old sink before it is replaced
+    this->apu->setAudioSink(nullptr);
+    this->callbackSink.reset();
 
-        if (this->processAudioSamplesFn != nullptr)
-            this->processAudioSamplesFn(this->bufferedAudio.data(), this->bufferedAudio.size());
+    if (processSamplesFn != nullptr) {
+        this->callbackSink = std::make_unique<CallbackAudioSink>(processSamplesFn);
+        this->apu->setAudioSink(this->callbackSink.get());
     }
 }
 
-void Console::RegisterAudioCallback(ProcessAudioSamples processSamplesFn) {
-    this->processAudioSamplesFn = processSamplesFn;
+RingAudioSink::RingAudioSink(AudioRing &r) :
+    ring(r) {
+}
+
+size_t RingAudioSink::droppedSamples() const {
+    return this->dropped.load(std::memory_order_relaxed);
+}
+
+void RingAudioSink::writeSamples(float samples[], size_t n) {
+    const size_t pushed = this->ring.push(samples, n);
+    if (pushed < n)
+        this->dropped.fetch_add(n - pushed, std::memory_order_relaxed);
+}
+
+CallbackAudioSink::CallbackAudioSink(ProcessAudioSamples processAudioSamplesFn) :
+    processAudioSamplesFn(std::move(processAudioSamplesFn)) {
+}
+
+void CallbackAudioSink::writeSamples(float samples[], size_t n) {
+    this->processAudioSamplesFn(samples, n);
 }
 
 } // namespace nes
\ No newline at end of file
@@ -2,13 +2,61 @@
 #include "cartridge.h"
 #include "controller.h"
 #include "nes.h"
+#include "palette.h"
+#include "ring.h"
 #include <SDL_surface.h>
+#include <optional>
 
 namespace nes {
 
-using ProcessAudioSample  = std::function<void(float)>;
 using ProcessAudioSamples = std::function<void(float samples[], size_t n)>;
 
+// Receives the filtered audio once per APU block of about 110 samples, on the thread that synthesizes it.
+class AudioSink {
+public:
+    virtual ~AudioSink() = default;
+    virtual void writeSamples(float samples[], size_t n) = 0;
+};
+
+// Appends the audio straight to a ring owned by the caller, which is its only consumer.
+class RingAudioSink : public AudioSink {
+private:
+    AudioRing &ring;
+    std::atomic<size_t> dropped{0};
+
+public:
+    explicit RingAudioSink(AudioRing &ring);
+
+    // samples that didn't fit into the ring
+    size_t droppedSamples() const;
+
+    void writeSamples(float samples[], size_t n) override;
+};
+
+// A per-frame summary of what the APU plays, taken from the channel state instead of the samples.
+// Channels are in the order pulse 1, pulse 2, triangle, noise, DMC. All floats, to be copied as an array.
+struct AudioFeatures {
+    static const int CHANNELS = 5;
+    static const int SIZE     = 3 * CHANNELS + 1;
+
+    std::array<float, CHANNELS> active;    // 1 when the channel is audible at the end of the frame
+    std::array<float, CHANNELS> frequency; // Hz of the waveform, of the bit clock for noise and DMC
+    std::array<float, CHANNELS> volume;    // envelope level in [0, 1], the triangle's is 1 while active
+                                           // and the DMC's is its output level
+    float rms;                             // of the mixer output over the frame around its mean
+};
+static_assert(sizeof(AudioFeatures) == AudioFeatures::SIZE * sizeof(float));
+
+class CallbackAudioSink : public AudioSink {
+private:
+    ProcessAudioSamples processAudioSamplesFn;
+
+public:
+    explicit CallbackAudioSink(ProcessAudioSamples processAudioSamplesFn);
+
+    void writeSamples(float samples[], size_t n) override;
+};
+
 class APU;
 class CPU;
 class PPU;
@@ -25,29 +73,63 @@ public:
 private:
 #endif
     Controller controller;
+    uint64_t cycles = 0; // CPU cycles up to the start of the current instruction
     std::unique_ptr<Mapper> mapper;
     std::unique_ptr<APU> apu;
     std::unique_ptr<CPU> cpu;
     std::unique_ptr<PPU> ppu;
 
-    ProcessAudioSamples processAudioSamplesFn = nullptr;
-
-    std::array<float, 400> bufferedAudio      = {0};
-    size_t samplePos                          = this->bufferedAudio.size() - 1;
+    std::unique_ptr<CallbackAudioSink> callbackSink;
 
     Console(std::unique_ptr<Mapper> &&);
 
-    void bufferAudioSample(float);
-
 public:
     static std::shared_ptr<Console> Create(std::unique_ptr<Mapper> &&);
+    ~Console();
+
+    // A console in the same state that runs on independently, for search or rollback. ROM is shared, and so are
+    // the cartridge's RAM pages until either console writes to them. The clone starts without audio sink,
+    // audio thread, render threads or save file.
+    std::shared_ptr<Console> Clone();
 
     void StepFrame();
 
+    // Deliver audio to a sink owned by the caller, nullptr for none. It has to outlive the console or be replaced.
+    void SetAudioSink(AudioSink *sink);
+
+    // Deliver audio to a callback, a block of samples at a time
     void RegisterAudioCallback(ProcessAudioSamples processAudioSamplesFn);
 
+    // Convert the last completed frame to any pixel format, pitch bytes apart per line.
+    void ConvertFrame(const PixelConverter &converter, void *pixels, size_t pitch) const;
+
     void DrawFrame(SDL_Surface *surface, uint8_t scaling) const;
 
+    // Write the AudioFeatures::SIZE audio features of the last completed frame.
+    // The rms is only measured where audio is synthesized on the emulation thread, otherwise it is 0.
+    void WriteAudioFeatures(float *out) const;
+
+    // Draw frames without mid-frame raster effects on a pool of numThreads workers.
+    // Pays off for a single console at high frame rates, not for many consoles sharing the cores.
+    void SetRenderThreads(size_t numThreads);
+
+    // Skip generating audio entirely, for consoles nobody listens to. Games still see the same APU state.
+    void SetAudioEnabled(bool enabled);
+
+    // Synthesize audio a frame at a time on a worker thread, which then also feeds the audio sink.
+    // Disabling audio stops it too.
+    void SetAudioThread(bool enabled);
+
+    // Keep battery-backed PRG RAM in a save file, read from it when it exists. Call before the first frame.
+    // Returns false for cartridges without a battery, which keep their RAM in memory.
+    bool UseSaveFile(const std::string &path);
+
+    // Patch the game with a 6 or 8 letter Game Genie code. Throws std::runtime_error for invalid codes.
+    void AddGameGenieCode(const std::string &code);
+
+    // Patch the ROM with an IPS file made against the iNES file. Call before the first frame.
+    void ApplyIPSPatch(const std::string &path);
+
     void SetButton(Buttons button, bool status);
 };
 
@@ -4,6 +4,7 @@
 #include "ppu.h"
 #include <iostream>
 #include <string_view>
+#include <utility>
 
 
 namespace nes {
@@ -275,14 +276,29 @@ static bool crossesPageBoundary(Address a, Address b) {
     return (a & 0xff00) != (b & 0xff00);
 }
 
+Byte CPU::fetch(Address addr) const {
+    // same as read, without going through the memory map and the mapper's Read
+    if (addr >= 0x8000)
+        if (const Byte *page = this->console.mapper->PRGPage(addr))
+            return page[addr % Cartridge::PRG_PAGE_SIZE];
+
+    return this->read(addr);
+}
+
+Address CPU::fetchAddress(Address addr) const {
+    return this->fetch(addr + 1) << 8 | this->fetch(addr);
+}
+
 uint16_t CPU::step() {
+    // DMA stalls since the last step are part of this one
     auto prevCycle = this->cycle;
+    this->cycle += std::exchange(this->stalledCycles, 0);
 
     if (this->handleInterrupt())
         return this->cycle - prevCycle;
 
     auto prePC         = this->pc;
-    auto instFirstByte = this->read(this->pc);
+    auto instFirstByte = this->fetch(this->pc);
     auto decoded       = decodeTable[instFirstByte];
 
     Address address    = 0;
@@ -298,7 +314,7 @@ uint16_t CPU::step() {
             // read + alu cycles tracked in instFirstByte
             break;
         case AddressingMode::Absolute:
-            address = this->readAddress(this->pc);
+            address = this->fetchAddress(this->pc);
             this->pc += 2;
             break;
         case AddressingMode::Immediate:
@@ -306,13 +322,13 @@ uint16_t CPU::step() {
             this->pc++;
             break;
         case AddressingMode::AbsoluteIndexedX:
-            indirect = this->readAddress(this->pc);
+            indirect = this->fetchAddress(this->pc);
             address  = indirect + this->regX;
             this->pc += 2;
             this->cycle += decoded.PageBoundaryHit && crossesPageBoundary(indirect, address);
             break;
         case AddressingMode::AbsoluteIndexedY:
-            indirect = this->readAddress(this->pc);
+            indirect = this->fetchAddress(this->pc);
             address  = indirect + this->regY;
             this->pc += 2;
             this->cycle += decoded.PageBoundaryHit && crossesPageBoundary(indirect, address);
@@ -321,19 +337,19 @@ uint16_t CPU::step() {
             // val = PEEK(PEEK((arg + X) % 256) + PEEK((arg + X + 1) % 256) * 256)
             // val = PEEK(
             // zero page wrap around
-            offset   = this->read(this->pc);
+            offset   = this->fetch(this->pc);
             indirect = Byte(offset + regX);
             address  = this->readAddressIndirectWraparound(indirect);
             this->pc += 1;
             break;
         case AddressingMode::Indirect:
-            indirect = this->readAddress(this->pc);
+            indirect = this->fetchAddress(this->pc);
             address  = this->readAddressIndirectWraparound(indirect);
             this->pc += 2;
             break;
         case AddressingMode::IndirectIndexed:
             // val = PEEK(PEEK(arg) + PEEK((arg + 1) % 256) * 256 + Y)
-            offset   = this->read(this->pc);
+            offset   = this->fetch(this->pc);
             indirect = this->readAddressIndirectWraparound(offset);
             address  = indirect + this->regY;
             this->pc += 1;
@@ -341,7 +357,7 @@ uint16_t CPU::step() {
             break;
         case AddressingMode::Relative:
             // TODO: check that this handles negative offsets correctly
-            offset = this->read(this->pc);
+            offset = this->fetch(this->pc);
             this->pc++;
 
             if (offset & 0x80)
@@ -350,17 +366,17 @@ uint16_t CPU::step() {
                 address = this->pc + Address(offset);
             break;
         case AddressingMode::ZeroPage:
-            offset  = this->read(this->pc);
+            offset  = this->fetch(this->pc);
             address = offset;
             this->pc++;
             break;
         case AddressingMode::ZeroPageIndexedX:
-            offset  = this->read(this->pc);
+            offset  = this->fetch(this->pc);
             address = Byte(offset + this->regX);
             this->pc++;
             break;
         case AddressingMode::ZeroPageIndexedY:
-            offset  = this->read(this->pc);
+            offset  = this->fetch(this->pc);
             address = Byte(offset + this->regY);
             this->pc++;
             break;
@@ -1311,8 +1327,13 @@ void CPU::write(Address addr, Byte data) {
     else if (addr < 0x401f)
         // only enabled for CPU test mode
         return;
-    else
+    else {
+        // bank switches change what the PPU fetches for the rest of the frame
+        if (addr >= 0x8000)
+            this->console.ppu->onRasterEffect();
+
         this->console.mapper->Write(addr, data);
+    }
 }
 
 Address CPU::readAddress(Address addr) const {
@@ -1348,6 +1369,10 @@ void CPU::interrupt(Interrupt interrupt) {
     }
 }
 
+void CPU::stall(uint16_t cycles) {
+    this->stalledCycles += cycles;
+}
+
 void CPU::PC(Address addr) {
     this->pc = addr;
 }
@@ -1401,4 +1426,17 @@ CPU::CPU(Console &c) :
     console(c) {
     this->reset();
 }
+
+void CPU::copyFrom(const CPU &other) {
+    this->ram              = other.ram;
+    this->regA             = other.regA;
+    this->regX             = other.regX;
+    this->regY             = other.regY;
+    this->regSP            = other.regSP;
+    this->pc               = other.pc;
+    this->status           = other.status;
+    this->cycle            = other.cycle;
+    this->stalledCycles    = other.stalledCycles;
+    this->pendingInterrupt = other.pendingInterrupt;
+}
 } // namespace nes
\ No newline at end of file
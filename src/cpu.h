@@ -65,13 +65,18 @@ class CPU {
     using Status        = std::bitset<8>;
     using WordWithCarry = uint16_t;
 
+#ifdef _NES_TEST
+public:
+#else
 private:
+#endif
     Console &console;
     std::array<Byte, 0x800> ram = {0};
     Byte regA, regX, regY, regSP;
     Address pc;
     Status status;
     uint64_t cycle;
+    uint16_t stalledCycles     = 0;
     Interrupt pendingInterrupt = Interrupt::None;
 
     // TODO: consider make an opcode-based jump table of 256 entries for more specialized code,
@@ -101,6 +106,10 @@ private:
 
     Byte read(Address addr) const;
     const Byte *DMAStart(Address addr) const;
+
+    // instruction bytes, straight from the mapper's page table when they're in ROM
+    inline Byte fetch(Address addr) const;
+    inline Address fetchAddress(Address addr) const;
     Address readAddress(Address addr) const;
     Address readAddressIndirectWraparound(Address addr) const;
 
@@ -115,8 +124,14 @@ public:
 
     void interrupt(Interrupt interrupt);
 
+    // halt the CPU for DMA, charged to the next step
+    void stall(uint16_t cycles);
+
     void PC(Address addr);
     bool handleInterrupt();
+
+    // registers, RAM and pending interrupts of another console's CPU, for a cloned console
+    void copyFrom(const CPU &other);
 };
 
 } // namespace nes
\ No newline at end of file
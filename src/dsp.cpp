@@ -1,5 +1,6 @@
 #include "dsp.h"
 #include "math.h"
+#include <cstring>
 
 namespace nes {
 float FirstOrderFilter::filter(float input) {
@@ -8,6 +9,21 @@ float FirstOrderFilter::filter(float input) {
     return this->outPrev;
 }
 
+void FirstOrderFilter::filter(float *samples, size_t n) {
+    // keep the state in locals so it stays in registers for the whole block
+    float inPrev = this->inPrev, outPrev = this->outPrev;
+
+    for (size_t i = 0; i < n; i++) {
+        float input = samples[i];
+        outPrev     = (inPrev * this->inPrevWeight) + (outPrev * this->outPrevWeight) + (this->inWeight * input);
+        inPrev      = input;
+        samples[i]  = outPrev;
+    }
+
+    this->inPrev  = inPrev;
+    this->outPrev = outPrev;
+}
+
 HighPassFilter::HighPassFilter(float sampleRate, float freq) {
     float dt            = 1 / sampleRate;
     float rc            = 1 / (2.0 * M_PI * freq);
@@ -26,4 +42,76 @@ LowPassFilter::LowPassFilter(float sampleRate, float freq) {
     this->inPrevWeight  = 0;
     this->outPrevWeight = (1 - this->inWeight);
 }
+
+// windowed sinc impulses for each phase, each summing to 1 so a step ends up at exactly its height
+using BlipKernel = std::array<std::array<float, BlipBuffer::KERNEL_WIDTH>, BlipBuffer::PHASES>;
+
+static BlipKernel makeBlipKernel() {
+    BlipKernel kernel;
+
+    // cut off a bit below Nyquist, the Blackman window takes care of the rest of the rolloff
+    const double cutoff = 0.45;
+    const double half   = BlipBuffer::KERNEL_WIDTH / 2.0;
+
+    for (int phase = 0; phase < BlipBuffer::PHASES; phase++) {
+        double sum = 0;
+        for (int tap = 0; tap < BlipBuffer::KERNEL_WIDTH; tap++) {
+            // distance from the step, which is centered in the kernel
+            const double x      = tap + 0.5 - half - double(phase) / BlipBuffer::PHASES;
+            const double sinc   = (x == 0) ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+            const double n      = (x + half) / BlipBuffer::KERNEL_WIDTH;
+            const double window = 0.42 - 0.5 * cos(2 * M_PI * n) + 0.08 * cos(4 * M_PI * n);
+
+            kernel[phase][tap] = sinc * window;
+            sum += kernel[phase][tap];
+        }
+
+        for (auto &tap: kernel[phase])
+            tap /= sum;
+    }
+
+    return kernel;
+}
+
+static const BlipKernel blipKernel = makeBlipKernel();
+
+BlipBuffer::BlipBuffer(uint32_t clockRate, uint32_t sampleRate, size_t maxSamples) :
+    clockRate(clockRate), sampleRate(sampleRate), deltas(maxSamples + KERNEL_WIDTH, 0) {
+}
+
+void BlipBuffer::addDelta(uint32_t time, float delta) {
+    const uint64_t position = this->offset + uint64_t(time) * this->sampleRate;
+    const size_t index      = position / this->clockRate;
+    const size_t phase      = (position % this->clockRate) * PHASES / this->clockRate;
+
+    auto &impulse           = blipKernel[phase];
+    for (int tap = 0; tap < KERNEL_WIDTH; tap++)
+        this->deltas[index + tap] += delta * impulse[tap];
+}
+
+void BlipBuffer::endBlock(uint32_t clocks) {
+    this->offset += uint64_t(clocks) * this->sampleRate;
+}
+
+size_t BlipBuffer::samplesAvailable() const {
+    return this->offset / this->clockRate;
+}
+
+size_t BlipBuffer::readSamples(float *out, size_t n) {
+    n = std::min(n, this->samplesAvailable());
+
+    // the buffer holds the differences of the output, so integrate them
+    for (size_t i = 0; i < n; i++) {
+        this->integrator += this->deltas[i];
+        out[i] = float(this->integrator);
+    }
+
+    // keep the tails of the steps near the end of the block for the next read
+    const size_t remaining = this->samplesAvailable() - n + KERNEL_WIDTH;
+    std::memmove(this->deltas.data(), this->deltas.data() + n, remaining * sizeof(float));
+    std::fill(this->deltas.begin() + remaining, this->deltas.end(), 0.0f);
+
+    this->offset -= n * this->clockRate;
+    return n;
+}
 } // namespace nes
\ No newline at end of file
@@ -10,6 +10,9 @@ protected:
 
 public:
     float filter(float input);
+
+    // filter a block in place, carrying the state over to the next block
+    void filter(float *samples, size_t n);
 };
 
 class LowPassFilter : public FirstOrderFilter {
@@ -21,4 +24,35 @@ class HighPassFilter : public FirstOrderFilter {
 public:
     HighPassFilter(float sampleRate, float freq);
 };
+
+// Band-limited synthesis of a signal that only changes in steps. Amplitude deltas are added at
+// exact clock timestamps and come out at the sample rate without the aliasing of point sampling.
+// https://www.slack.net/~ant/bl-synth/
+class BlipBuffer {
+public:
+    static const int KERNEL_WIDTH = 16; // output samples each step is spread across
+    static const int PHASES       = 64; // sub-sample positions a step can land on
+
+private:
+    uint64_t clockRate;
+    uint64_t sampleRate;
+    uint64_t offset   = 0; // end of the block in 1 / clockRate samples, from the first unread sample
+    double integrator = 0;
+    std::vector<float> deltas;
+
+public:
+    BlipBuffer(uint32_t clockRate, uint32_t sampleRate, size_t maxSamples);
+
+    // a change in amplitude at a clock time relative to the start of the current block
+    void addDelta(uint32_t time, float delta);
+
+    // finish the block after a number of clocks, making the samples it completed readable.
+    // Blocks must be short enough that maxSamples are never exceeded.
+    void endBlock(uint32_t clocks);
+
+    size_t samplesAvailable() const;
+
+    // remove up to n of the available samples, returning how many were written to out
+    size_t readSamples(float *out, size_t n);
+};
 } // namespace nes
\ No newline at end of file
@@ -1,9 +1,13 @@
 #include "game.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
 
 
 namespace nes {
 
 InteractiveConsole::~InteractiveConsole() {
+    this->console->SetAudioThread(false);
     this->console->RegisterAudioCallback(nullptr);
 
     if (this->audioDeviceID)
@@ -19,6 +23,7 @@ InteractiveConsole::~InteractiveConsole() {
 InteractiveConsole::InteractiveConsole(const std::string &romPath) {
     auto mapper   = nes::LoadRomFile(romPath);
     this->console = Console::Create(std::move(mapper));
+    this->console->UseSaveFile(std::filesystem::path(romPath).replace_extension(".sav").string());
 
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0)
         throw std::runtime_error(std::string("could not initialize sdl2: ").append(SDL_GetError()));
@@ -27,17 +32,22 @@ InteractiveConsole::InteractiveConsole(const std::string &romPath) {
             .freq     = 48000,
             .format   = AUDIO_F32SYS,
             .channels = 1,
-            .samples  = 0,
+            .samples  = 512,
             .size     = 0,
-            .callback = nullptr,
-            .userdata = nullptr,
+            .callback = InteractiveConsole::pullAudio,
+            .userdata = this,
     };
 
-    this->audioDeviceID = SDL_OpenAudioDevice(NULL, 0, &desired, &this->audioSpec, SDL_AUDIO_ALLOW_ANY_CHANGE);
+    // SDL converts other formats for us, the rate and buffer size are handled here
+    this->audioDeviceID = SDL_OpenAudioDevice(NULL, 0, &desired, &this->audioSpec,
+                                              SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
     if (audioDeviceID <= 0) {
         throw std::runtime_error(std::string("could open SDL2 device: ").append(SDL_GetError()));
     }
 
+    // two device buffers of latency leaves room for the emulation thread to be late
+    this->targetFill = std::min<size_t>(2 * this->audioSpec.samples, this->audioRing.capacity() / 2);
+
     this->window = SDL_CreateWindow("nes", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 2 * nes::PPU::SCREEN_WIDTH,
                                     2 * nes::PPU::SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
 
@@ -51,13 +61,11 @@ InteractiveConsole::InteractiveConsole(const std::string &romPath) {
     }
 
 
-    const auto copyAudioDevice          = this->audioDeviceID;
-    nes::ProcessAudioSamples queueAudio = [=](float samples[], size_t n) {
-        const static size_t bytesPerSample = sizeof(*samples);
-        SDL_QueueAudio(copyAudioDevice, samples, n * bytesPerSample);
-    };
+    this->console->RegisterAudioCallback([this](float samples[], size_t n) { this->queueAudio(samples, n); });
 
-    this->console->RegisterAudioCallback(queueAudio);
+    // the emulation thread is the bottleneck, so spare cores take the audio
+    if (std::thread::hardware_concurrency() >= 4)
+        this->console->SetAudioThread(true);
 
     // resume audio
     SDL_PauseAudio(false);
@@ -67,7 +75,48 @@ InteractiveConsole::InteractiveConsole(const std::string &romPath) {
     SDL_Event ignored;
     SDL_PollEvent(&ignored);
 
-    this->lastTick = std::chrono::high_resolution_clock::now();
+    this->lastTick = std::chrono::steady_clock::now();
+}
+
+void InteractiveConsole::queueAudio(const float samples[], size_t n) {
+    // https://github.com/libretro/docs/blob/master/archive/ratecontrol.pdf
+    // stretch or squeeze the audio by up to 0.5%, which can't be heard, to keep the ring at its target fill
+    const double maxRateDelta = 0.005;
+    const double fill         = double(this->audioRing.size()) / this->targetFill;
+    const double correction   = std::clamp(1.0 + maxRateDelta * (1.0 - fill), 1.0 - maxRateDelta, 1.0 + maxRateDelta);
+    const double step         = 48000.0 / this->audioSpec.freq / correction; // input samples per output sample
+
+    // linear interpolation, where input -1 is the last sample of the previous block
+    std::array<float, 512> resampled;
+    size_t count = 0;
+    for (; this->resamplePosition < double(n) - 1; this->resamplePosition += step) {
+        const auto index = ptrdiff_t(std::floor(this->resamplePosition));
+        const auto frac  = float(this->resamplePosition - index);
+        const float a    = index < 0 ? this->lastSample : samples[index];
+        const float b    = samples[index + 1];
+
+        resampled[count++] = a + (b - a) * frac;
+        if (count == resampled.size()) {
+            this->audioRing.push(resampled.data(), count);
+            count = 0;
+        }
+    }
+
+    // anything that doesn't fit is dropped, the correction will catch up
+    this->audioRing.push(resampled.data(), count);
+    this->resamplePosition -= double(n);
+    this->lastSample = samples[n - 1];
+}
+
+void InteractiveConsole::pullAudio(void *userdata, Uint8 *stream, int len) {
+    // runs on SDL's audio thread
+    auto self     = static_cast<InteractiveConsole *>(userdata);
+    auto out      = reinterpret_cast<float *>(stream);
+    size_t n      = len / sizeof(float);
+    size_t pulled = self->audioRing.pop(out, n);
+
+    // underrun: silence rather than repeating stale samples
+    std::fill(out + pulled, out + n, 0.0f);
 }
 
 void InteractiveConsole::StepAndDraw() {
@@ -86,7 +135,7 @@ void InteractiveConsole::FrameLimit() {
     const static auto frameTime = std::chrono::duration<double, std::micro>(1000000.0 / 60.0);
 
     std::this_thread::sleep_until(this->lastTick + frameTime);
-    this->lastTick = std::chrono::high_resolution_clock::now();
+    this->lastTick = std::chrono::steady_clock::now();
 }
 
 void InteractiveConsole::HandleInteraction() {
@@ -2,6 +2,7 @@
 #include "cpu.h"
 #include "nes.h"
 #include "ppu.h"
+#include "ring.h"
 #include "rom.h"
 #include <SDL2/SDL.h>
 #include <iostream>
@@ -22,8 +23,17 @@ private:
     SDL_Surface *surface            = nullptr;
     SDL_AudioDeviceID audioDeviceID = 0;
 
+    // audio is pulled by the device from a ring, resampled on the way in so the ring stays near targetFill
+    AudioRing audioRing{16384};
+    size_t targetFill       = 0;
+    double resamplePosition = 0;
+    float lastSample        = 0;
+
     std::chrono::steady_clock::time_point lastTick;
 
+    void queueAudio(const float samples[], size_t n);
+    static void pullAudio(void *userdata, Uint8 *stream, int len);
+
 public:
     InteractiveConsole(const std::string &romPath);
     void Loop();
@@ -1,9 +1,13 @@
+#include "audiorender.h"
 #include "cpu.h"
 #include "game.h"
 #include "nes.h"
 #include "ppu.h"
 #include "rom.h"
+#include "romindex.h"
 #include <SDL2/SDL.h>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <stdio.h>
 #include <thread>
@@ -92,21 +96,92 @@ int drawTiles(std::string romPath) {
     return 0;
 }
 
+int renderAudio(const std::string &romPath, const std::string &inputPath, const std::string &wavPath) {
+    try {
+        nes::RenderAudio(nes::AudioRenderJob{romPath, inputPath, wavPath});
+        return 0;
+    } catch (std::runtime_error &exc) {
+        std::cerr << exc.what() << std::endl;
+        return 1;
+    }
+}
+
+int renderAudioBatch(const std::string &jobsPath) {
+    // one job per line: <rom file> <input log> <wav file>
+    std::ifstream jobsFile(jobsPath);
+    if (!jobsFile) {
+        std::cerr << "failed to open: " << jobsPath << std::endl;
+        return 1;
+    }
+
+    std::vector<nes::AudioRenderJob> jobs;
+    nes::AudioRenderJob job;
+    while (jobsFile >> job.romPath >> job.inputPath >> job.wavPath)
+        jobs.push_back(job);
+
+    return nes::RenderAudio(jobs, std::thread::hardware_concurrency()) == 0 ? 0 : 1;
+}
+
+void usage(const char *name) {
+    printf("usage: %s <play|dump> <rom file>\n", name);
+    printf("       %s render <rom file> <input log> <wav file|->\n", name);
+    printf("       %s render-batch <job list>\n", name);
+    printf("       %s cache <rom file> <cache file>\n", name);
+    printf("       %s index <rom dir> [index file]\n", name);
+}
+
+int writeRomCache(const std::string &romPath, const std::string &cachePath) {
+    try {
+        nes::WriteRomCache(romPath, cachePath);
+        return 0;
+    } catch (std::runtime_error &exc) {
+        std::cerr << exc.what() << std::endl;
+        return 1;
+    }
+}
+
+int indexRoms(const std::string &dir, const std::string &indexPath) {
+    try {
+        auto index = nes::RomIndex::Build(dir, std::thread::hardware_concurrency());
+        index.save(indexPath);
+
+        auto &entries    = index.all();
+        size_t supported = std::count_if(entries.begin(), entries.end(), [](auto &entry) { return entry.supported; });
+        printf("indexed %zu ROMs, %zu supported, in %s\n", entries.size(), supported, indexPath.c_str());
+        return 0;
+    } catch (std::runtime_error &exc) {
+        std::cerr << exc.what() << std::endl;
+        return 1;
+    }
+}
+
 int main(int argc, char *argv[]) {
+    auto command = std::string(argc > 1 ? argv[1] : "");
+
+    if (command == "render" && argc == 5)
+        return renderAudio(argv[2], argv[3], argv[4]);
+
+    if (command == "cache" && argc == 4)
+        return writeRomCache(argv[2], argv[3]);
+
+    if (command == "index" && (argc == 3 || argc == 4))
+        return indexRoms(argv[2], argc == 4 ? argv[3] : std::string(argv[2]) + "/roms.index");
+
     if (argc != 3) {
-        printf("usage: %s <play|dump> <rom file>\n", argv[0]);
+        usage(argv[0]);
         return 1;
     }
 
-    auto command = std::string(argv[1]);
-    auto file    = std::string(argv[2]);
+    auto file = std::string(argv[2]);
 
     if (command == "play")
         nes::InteractiveConsole(file).Loop();
     else if (command == "dump")
         return drawTiles(file);
+    else if (command == "render-batch")
+        return renderAudioBatch(file);
     else
-        printf("usage: %s <play|dump> <rom file>\n", argv[0]);
+        usage(argv[0]);
 
     return 1;
 }
\ No newline at end of file
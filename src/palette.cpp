@@ -0,0 +1,119 @@
+#include "palette.h"
+#include <cstring>
+
+namespace nes {
+
+static const uint32_t colorPaletteRGB[] = {
+        0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00, 0x333500, 0x0B4800, 0x005200,
+        0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000, 0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B,
+        0xB53120, 0x994E00, 0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000, 0xFFFEFF,
+        0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22, 0xBCBE00, 0x88D800, 0x5CE430, 0x45E082,
+        0x48CDDE, 0x4F4F4F, 0x000000, 0x000000, 0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5,
+        0xF7D8A5, 0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000,
+};
+
+// https://www.nesdev.org/wiki/Colour_emphasis
+uint32_t PaletteRGB(PaletteIndex index) {
+    const Byte color    = index & 0x3f;
+    const Byte emphasis = (index >> 6) & 0x7; // red, green, blue
+    uint32_t rgb        = colorPaletteRGB[color];
+
+    // emphasis has no effect on the blacks in columns $E and $F
+    if (emphasis == 0 || (color & 0xe) == 0xe)
+        return rgb;
+
+    // each emphasis bit darkens the other two channels, approximated as a single 3/4 attenuation
+    for (int channel = 0; channel < 3; channel++) {
+        if ((emphasis & ~(1 << channel)) == 0)
+            continue;
+
+        const int shift = 16 - 8 * channel;
+        uint32_t value  = (rgb >> shift) & 0xff;
+        rgb             = (rgb & ~(0xffu << shift)) | ((value * 3 / 4) << shift);
+    }
+
+    return rgb;
+}
+
+PixelConverter::PixelConverter(PixelFormat format) : pixelFormat(format) {
+    for (size_t index = 0; index < this->lut.size(); index++) {
+        const uint32_t rgb = PaletteRGB(index);
+        const uint32_t r = (rgb >> 16) & 0xff, g = (rgb >> 8) & 0xff, b = rgb & 0xff;
+
+        switch (format) {
+            case PixelFormat::RGBA8888:
+                this->lut[index] = rgb << 8 | 0xff;
+                break;
+            case PixelFormat::BGRA8888:
+                this->lut[index] = b << 24 | g << 16 | r << 8 | 0xff;
+                break;
+            case PixelFormat::ARGB8888:
+                this->lut[index] = 0xff000000 | rgb;
+                break;
+            case PixelFormat::RGB565:
+                this->lut[index] = (r >> 3) << 11 | (g >> 2) << 5 | (b >> 3);
+                break;
+            case PixelFormat::RGB24: {
+                // stored in memory order, the 4th byte is ignored
+                const Byte bytes[4] = {Byte(r), Byte(g), Byte(b), 0};
+                std::memcpy(&this->lut[index], bytes, sizeof(bytes));
+                break;
+            }
+            case PixelFormat::Luma8:
+                // BT.601
+                this->lut[index] = (r * 299 + g * 587 + b * 114 + 500) / 1000;
+                break;
+        }
+    }
+}
+
+PixelFormat PixelConverter::format() const {
+    return this->pixelFormat;
+}
+
+size_t PixelConverter::bytesPerPixel() const {
+    switch (this->pixelFormat) {
+        case PixelFormat::RGB565:
+            return 2;
+        case PixelFormat::RGB24:
+            return 3;
+        case PixelFormat::Luma8:
+            return 1;
+        default:
+            return 4;
+    }
+}
+
+// a branch-free loop of table loads, simple enough for the compiler to unroll and vectorize
+template<typename Pixel>
+static void convertPacked(const std::array<uint32_t, 512> &lut, const PaletteIndex *indices, size_t count,
+                          Pixel *out) {
+    for (size_t i = 0; i < count; i++)
+        out[i] = Pixel(lut[indices[i] & 0x1ff]);
+}
+
+void PixelConverter::convert(const PaletteIndex *indices, size_t count, void *out) const {
+    switch (this->pixelFormat) {
+        case PixelFormat::RGB565:
+            convertPacked(this->lut, indices, count, static_cast<uint16_t *>(out));
+            break;
+        case PixelFormat::Luma8:
+            convertPacked(this->lut, indices, count, static_cast<Byte *>(out));
+            break;
+        case PixelFormat::RGB24: {
+            // write 4 bytes per pixel and let the next pixel overwrite the spare one
+            auto bytes = static_cast<Byte *>(out);
+            size_t i   = 0;
+            for (; i + 1 < count; i++)
+                std::memcpy(bytes + i * 3, &this->lut[indices[i] & 0x1ff], 4);
+            if (i < count)
+                std::memcpy(bytes + i * 3, &this->lut[indices[i] & 0x1ff], 3);
+            break;
+        }
+        default:
+            convertPacked(this->lut, indices, count, static_cast<uint32_t *>(out));
+            break;
+    }
+}
+
+} // namespace nes
@@ -0,0 +1,39 @@
+#pragma once
+#include "nes.h"
+
+namespace nes {
+
+// A pixel as the PPU outputs it: the emphasis bits of PPUMASK above the 6-bit NES color.
+// Greyscale is already applied by masking the color to its first column.
+using PaletteIndex = uint16_t;
+
+enum class PixelFormat {
+    RGBA8888, // packed 32-bit 0xRRGGBBAA
+    BGRA8888, // packed 32-bit 0xBBGGRRAA
+    ARGB8888, // packed 32-bit 0xAARRGGBB, also fine for RGB888 surfaces
+    RGB565,   // packed 16-bit
+    RGB24,    // 3 bytes: R, G, B
+    Luma8,    // 1 byte of brightness
+};
+
+// 0x00RRGGBB for a palette index, emphasis applied
+uint32_t PaletteRGB(PaletteIndex index);
+
+// Converts palette indices to one pixel format through a lookup table of every index,
+// so each pixel costs a single table load and store.
+class PixelConverter {
+private:
+    PixelFormat pixelFormat;
+    std::array<uint32_t, 512> lut;
+
+public:
+    explicit PixelConverter(PixelFormat format);
+
+    PixelFormat format() const;
+    size_t bytesPerPixel() const;
+
+    // write count pixels to out, which must hold count * bytesPerPixel() bytes
+    void convert(const PaletteIndex *indices, size_t count, void *out) const;
+};
+
+} // namespace nes
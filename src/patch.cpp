@@ -0,0 +1,99 @@
+#include "patch.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iterator>
+
+namespace nes {
+
+GameGenieCode ParseGameGenieCode(const std::string &code) {
+    static const std::string letters = "APZLGITYEOXUKSVN";
+
+    Byte n[8];
+    if (code.size() != 6 && code.size() != 8)
+        throw std::runtime_error(std::string("invalid Game Genie code: ") + code);
+
+    for (size_t i = 0; i < code.size(); i++) {
+        auto letter = letters.find(char(std::toupper(static_cast<unsigned char>(code[i]))));
+        if (letter == std::string::npos)
+            throw std::runtime_error(std::string("invalid Game Genie code: ") + code);
+        n[i] = Byte(letter);
+    }
+
+    // https://www.nesdev.org/wiki/Game_Genie#Decoding
+    GameGenieCode decoded;
+    decoded.addr = 0x8000 | (n[3] & 7) << 12 | (n[5] & 7) << 8 | (n[4] & 8) << 8 | (n[2] & 7) << 4 | (n[1] & 8) << 4 |
+                   (n[4] & 7) | (n[3] & 8);
+
+    if (code.size() == 6) {
+        decoded.value = (n[1] & 7) << 4 | (n[0] & 8) << 4 | (n[0] & 7) | (n[5] & 8);
+    } else {
+        decoded.value   = (n[1] & 7) << 4 | (n[0] & 8) << 4 | (n[0] & 7) | (n[7] & 8);
+        decoded.compare = (n[7] & 7) << 4 | (n[6] & 8) << 4 | (n[6] & 7) | (n[5] & 8);
+    }
+
+    return decoded;
+}
+
+// the patched copy of the page holding offset, copied from the ROM the first time it's patched
+static Byte &patchedByte(std::map<size_t, std::vector<Byte>> &patches, std::span<const Byte> rom, size_t offset,
+                         size_t pageSize) {
+    const size_t start = offset - offset % pageSize;
+    auto &page         = patches[start];
+    if (page.empty())
+        page.assign(rom.begin() + start, rom.begin() + std::min(start + pageSize, rom.size()));
+
+    return page[offset - start];
+}
+
+void ApplyIPSPatch(Cartridge &cartridge, const std::string &path) {
+    std::ifstream patchFile(path, std::ios_base::binary | std::ios_base::in);
+    if (!patchFile.is_open())
+        throw std::runtime_error(std::string("failed to open: ") + path);
+
+    const std::vector<Byte> patch{std::istreambuf_iterator<char>(patchFile), std::istreambuf_iterator<char>()};
+    const auto malformed = std::runtime_error(std::string("malformed IPS patch: ") + path);
+
+    size_t pos = 0;
+    auto read  = [&patch, &pos, &malformed](size_t n) {
+        if (pos + n > patch.size())
+            throw malformed;
+
+        uint32_t value = 0;
+        for (size_t i = 0; i < n; i++)
+            value = value << 8 | patch[pos++];
+        return value;
+    };
+
+    if (patch.size() < 5 || std::string(patch.begin(), patch.begin() + 5) != "PATCH")
+        throw malformed;
+    pos = 5;
+
+    // CHR RAM isn't in the file
+    const size_t prgStart = cartridge.prgFileOffset;
+    const size_t chrStart = prgStart + cartridge.prgROM.size();
+    const size_t chrEnd   = chrStart + cartridge.chrROM.size();
+
+    // records of a 24-bit file offset and 16-bit size, or a zero size with a 16-bit count and the byte to repeat
+    for (uint32_t offset = read(3); offset != 0x454f46; offset = read(3)) {
+        const uint32_t size = read(2);
+        const bool rle      = size == 0;
+        const uint32_t n    = rle ? read(2) : size;
+
+        if (offset < prgStart || offset + n > chrEnd)
+            throw std::runtime_error(std::string("IPS patch changes more than PRG and CHR ROM: ") + path);
+
+        const Byte fill = rle ? read(1) : 0;
+        for (uint32_t i = 0; i < n; i++) {
+            const Byte data = rle ? fill : read(1);
+            if (offset + i < chrStart)
+                patchedByte(cartridge.prgPatches, cartridge.prgROM, offset + i - prgStart, Cartridge::PRG_PAGE_SIZE) =
+                        data;
+            else
+                patchedByte(cartridge.chrPatches, cartridge.chrROM, offset + i - chrStart, Cartridge::CHR_PAGE_SIZE) =
+                        data;
+        }
+    }
+}
+
+} // namespace nes
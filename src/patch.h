@@ -0,0 +1,16 @@
+#pragma once
+#include "cartridge.h"
+#include "nes.h"
+#include <string>
+
+namespace nes {
+
+// Decode a 6 or 8 letter Game Genie code. Throws std::runtime_error when it isn't one.
+GameGenieCode ParseGameGenieCode(const std::string &code);
+
+// https://zerosoft.zophar.net/ips.php
+// Patch the cartridge's ROM pages with an IPS file made against its iNES file. Throws std::runtime_error when the file
+// is malformed or patches anything but PRG and CHR ROM. Remap the mapper afterwards.
+void ApplyIPSPatch(Cartridge &cartridge, const std::string &path);
+
+} // namespace nes
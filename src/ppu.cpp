@@ -1,22 +1,20 @@
 #include "ppu.h"
 #include "cpu.h"
+#include "threadpool.h"
+#include <bit>
+#include <cstring>
 
 namespace nes {
-uint32_t colorPaletteRGBA[] = {
-        0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00, 0x333500, 0x0B4800, 0x005200,
-        0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000, 0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B,
-        0xB53120, 0x994E00, 0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000, 0xFFFEFF,
-        0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22, 0xBCBE00, 0x88D800, 0x5CE430, 0x45E082,
-        0x48CDDE, 0x4F4F4F, 0x000000, 0x000000, 0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5,
-        0xF7D8A5, 0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000,
-};
-
 Byte TileData::color(uint8_t x) const {
     auto loBit = (this->patternLow >> (7 - x)) & 1;
     auto hiBit = (this->patternHigh >> (7 - x)) & 1;
     return (hiBit << 1) | loBit;
 }
 
+Byte TileData::background(uint8_t x) const {
+    return (this->palette & 0x3) << 2 | this->color(x);
+}
+
 Byte ProcessedSprite::color(uint8_t x) const {
     x = this->sprite.attributes.flipHorizontal ? (7 - x) : x;
     return this->tile.color(x);
@@ -78,6 +76,15 @@ Byte mirrorPalette(Byte offset) {
 PPU::PPU(nes::Console &c) :
     console(c) {
     this->reset();
+
+    // frames before rendering starts show black ($0F) rather than palette entry 0
+    for (auto &screen : this->screenBuffers)
+        std::fill_n(&screen[0][0], SCREEN_HEIGHT * SCREEN_WIDTH, PaletteIndex(0x0f));
+}
+
+PPU::~PPU() {
+    // the render pool may still be drawing into the screen buffers
+    this->finishDeferredRendering();
 }
 
 void PPU::reset() {
@@ -102,6 +109,7 @@ Byte PPU::readRegister(Address addr) {
         case 0x2004: // OAMDATA: $2004
             return this->oam[this->oamAddr];
         case 0x2007: // PPUDATA: $2007
+            this->onRasterEffect();
             contents = this->read(this->vramAddr.raw);
 
             // When reading while the VRAM address is in the range 0-$3EFF (i.e., before the palettes),
@@ -132,15 +140,18 @@ void PPU::writeDMA(const Byte *page) {
     if (page == nullptr)
         return;
 
-    // TODO: split into two unconditional memcpys!
-    if (this->oamAddr == 0)
-        std::memcpy(this->oam.data(), page, 256);
-    else
-        for (auto offset = 0; offset < 256; offset++)
-            this->oam[(this->oamAddr + offset) & 0xff] = page[offset];
+    this->onRasterEffect();
+    this->spriteIndex.stale = true;
+
+    // OAM is filled from oamAddr on, wrapping around to the start
+    const size_t untilEnd = this->oam.size() - this->oamAddr;
+    std::memcpy(this->oam.data() + this->oamAddr, page, untilEnd);
+    std::memcpy(this->oam.data(), page + untilEnd, this->oamAddr);
 }
 
 void PPU::writeRegister(Address addr, Byte data) {
+    this->onRasterEffect();
+
     // https://www.nesdev.org/wiki/PPU_scrolling#Register_controls
     switch (addr) {
         case 0x2000: // PPUCTRL: $2000
@@ -164,6 +175,7 @@ void PPU::writeRegister(Address addr, Byte data) {
         case 0x2004: // OAMDATA: $2004
             this->oam[this->oamAddr] = data;
             this->oamAddr++;
+            this->spriteIndex.stale = true;
             break;
         case 0x2005: // PPUSCROLL: $2005
             if (!this->writeToggle) {
@@ -203,12 +215,13 @@ void PPU::writeRegister(Address addr, Byte data) {
 }
 
 // https://www.nesdev.org/wiki/Mirroring#Nametable_Mirroring
-static const uint8_t nameTableMirrorings[4][4] = {
+static const uint8_t nameTableMirrorings[5][4] = {
         // 2000, 2400, 2800, 2C00
         {0, 0, 1, 1}, // Cartridge::MirroringMode::Horizontal            = 0
         {0, 1, 0, 1}, // Cartridge::MirroringMode::Vertical              = 1
-        {0, 0, 0, 0}, // Cartridge::MirroringMode::SingleScreenLowerBank = 3
-        {0, 1, 2, 3}, // Cartridge::MirroringMode::FourScreen            = 4
+        {0, 0, 0, 0}, // Cartridge::MirroringMode::SingleScreenLowerBank = 2
+        {0, 1, 2, 3}, // Cartridge::MirroringMode::FourScreen            = 3
+        {1, 1, 1, 1}, // Cartridge::MirroringMode::SingleScreenUpperBank = 4
 };
 
 Address mirrorNametable(Address addr, Cartridge::MirroringMode mode) {
@@ -221,8 +234,12 @@ Address mirrorNametable(Address addr, Cartridge::MirroringMode mode) {
 }
 
 Byte PPU::read(Address addr) const {
-    if (addr < 0x2000)
+    if (addr < 0x2000) {
+        if (const Byte *page = this->console.mapper->CHRPage(addr))
+            return page[addr & 0x3ff];
+
         return this->console.mapper->Read(addr);
+    }
     else if (addr < 0x3f00)
         return this->nametables[mirrorNametable(addr, this->console.mapper->cartridge->mirroringMode)];
     else
@@ -233,9 +250,12 @@ Byte PPU::read(Address addr) const {
 void PPU::write(Address addr, Byte data) {
     if (addr < 0x2000)
         this->console.mapper->Write(addr, data);
-    else if (addr < 0x3f00)
+    else if (addr < 0x3f00) {
         this->nametables[mirrorNametable(addr, this->console.mapper->cartridge->mirroringMode)] = data;
-    else
+
+        if (this->backgroundCache)
+            this->backgroundCache->invalidate(addr, this->console.mapper->cartridge->mirroringMode);
+    } else
         this->paletteRam[mirrorPalette(addr % 0x20)] = data;
 }
 
@@ -322,6 +342,173 @@ std::array<Sprite, 8> &PPU::secondarySprites() {
     return *((std::array<Sprite, 8> *) (&this->secondaryOam));
 }
 
+void SpriteIndex::rebuild(const std::array<Sprite, 64> &sprites, bool tall) {
+    const int spriteHeight = tall ? 16 : 8;
+
+    this->lines.fill(0);
+    for (size_t idx = 0; idx < sprites.size(); idx++) {
+        const int top = sprites[idx].yPosTop;
+        const int end = std::min<int>(top + spriteHeight, this->lines.size());
+
+        for (int line = top; line < end; line++)
+            this->lines[line] |= uint64_t(1) << idx;
+    }
+
+    this->tallSprites = tall;
+    this->stale       = false;
+}
+
+const SpriteIndex &PPU::spritesByLine() {
+    if (this->spriteIndex.stale || this->spriteIndex.tallSprites != bool(this->ppuCtrl.tallSprites))
+        this->spriteIndex.rebuild(this->primarySprites(), this->ppuCtrl.tallSprites);
+
+    return this->spriteIndex;
+}
+
+// The pixel the PPU outputs for a color from palette RAM.
+// https://www.nesdev.org/wiki/PPU_palettes#Color_effects
+static PaletteIndex outputPixel(PPUMASK ppuMask, Byte color) {
+    const Byte colorMask = ppuMask.greyscale ? 0x30 : 0x3f;
+    return PaletteIndex(ppuMask.raw & 0xe0) << 1 | (color & colorMask);
+}
+
+// Copy the first 8 sprites in range of the line (set bits of inRange) to the secondary OAM.
+// Sets overflow when > 8 are detected, and returns whether sprite zero is one of them.
+static bool evaluateSprites(const std::array<Sprite, 64> &primary, std::array<Sprite, 8> &secondary,
+                            uint64_t inRange, bool &overflow) {
+    const bool spriteZeroInLine = inRange & 1;
+
+    for (size_t nextSprite = 0; inRange != 0; nextSprite++) {
+        if (nextSprite == 8) {
+            overflow = true;
+            break;
+        }
+
+        secondary[nextSprite] = primary[std::countr_zero(inRange)];
+        inRange &= inRange - 1;
+    }
+
+    return spriteZeroInLine;
+}
+
+// Find the corresponding tiles for each sprite in the secondary OAM
+template<typename ReadFn>
+static void fetchSprites(const std::array<Sprite, 8> &secondary, std::array<ProcessedSprite, 8> &processed,
+                         uint16_t line, PPUCTRL ppuCtrl, ReadFn read) {
+    for (size_t s = 0; s < secondary.size(); s++) {
+        auto &processedSprite  = processed[s];
+        auto &sprite           = secondary[s];
+
+        processedSprite.sprite = sprite;
+        if (sprite.empty())
+            continue;
+
+        // retrieve the corresponding tile for the sprite
+        Byte spriteHeight           = ppuCtrl.tallSprites ? 16 : 8;
+        Byte bank                   = ppuCtrl.tallSprites ? sprite.tileIndex.bank : ppuCtrl.spritePatternTableAddress;
+        Address patternTableAddress = Address(bank) << 12;
+        Address tileIndex           = sprite.tileIndex.raw & ~Byte(ppuCtrl.tallSprites);
+        Byte tileY                  = line - sprite.yPosTop;
+
+        tileY                       = sprite.attributes.flipVertical ? (spriteHeight - 1 - tileY) : tileY;
+
+        // tall sprites are stored consecutively, so rewrite the address
+        tileIndex &= ~Byte(ppuCtrl.tallSprites);
+        tileIndex += tileY >= 8;
+        tileY &= 0x7;
+
+        processedSprite.tile = {
+                .patternLow  = read(patternTableAddress | (tileIndex << 4) | tileY),
+                .patternHigh = read(patternTableAddress | (tileIndex << 4) | (1 << 3) | tileY),
+        };
+    }
+}
+
+// Pick the palette index of a single pixel from the background pixel (attribute palette << 2 | tile color)
+// and the sprites on the line. firstSpriteDrawn is set when the sprite in the first slot won the pixel.
+static Byte compositePixel(PPUMASK ppuMask, Byte background, const std::array<ProcessedSprite, 8> &sprites, Byte x,
+                           bool &firstSpriteDrawn) {
+    // split the background pixel
+    Byte tilePaletteIndex  = background & 0x3;
+    Byte tilePaletteOffset = background & 0xc;
+
+    // fetch the sprite pixel
+    Byte spPos             = 0;
+    Byte spPaletteIndex    = 0;
+    Byte spPaletteOffset   = 0;
+    bool spInBackground    = false;
+
+    for (spPos = 0; spPos < 8; spPos++) {
+        auto &processedSprite = sprites[spPos];
+        if (!ppuMask.showSprites || processedSprite.sprite.empty())
+            break;
+
+        if (x >= processedSprite.sprite.xPosLeft && x < (processedSprite.sprite.xPosLeft + 8)) {
+            auto spX       = x - processedSprite.sprite.xPosLeft;
+            spPaletteIndex = processedSprite.color(spX);
+            if (spPaletteIndex != 0) {
+                spPaletteOffset = processedSprite.sprite.attributes.palette << 2;
+                spInBackground  = processedSprite.sprite.attributes.priorityBehindBackground;
+                break;
+            }
+        }
+    }
+
+    // https://www.nesdev.org/wiki/PPU_rendering#Preface
+    // Priority multiplexer decision table
+    // Implemented as a predefined array to reduce branching
+    enum class MultiplexerDecision {
+        drawBackground = 0,
+        drawTile       = 1,
+        drawSprite     = 2,
+    };
+
+    const static MultiplexerDecision multiplexer[8]{
+            // bg==0, sp==0, priority==X
+            MultiplexerDecision::drawBackground,
+            MultiplexerDecision::drawBackground,
+            // bg==0, sp!=0, priority==X
+            MultiplexerDecision::drawSprite,
+            MultiplexerDecision::drawSprite,
+            // bg!=0, sp==0, priority==X
+            MultiplexerDecision::drawTile,
+            MultiplexerDecision::drawTile,
+            // bg!=0, sp!=0, priority==foreground
+            MultiplexerDecision::drawSprite,
+            // bg!=0, sp!=0, priority==background
+            MultiplexerDecision::drawTile,
+    };
+
+    MultiplexerDecision md = multiplexer[(tilePaletteIndex != 0) << 2 | (spPaletteIndex != 0) << 1 | (spInBackground)];
+    Byte multiplexedColors[3] = {
+            // background
+            0, //
+            // drawTile
+            Byte(tilePaletteOffset | tilePaletteIndex),
+            // drawSprite
+            Byte(0x10 | spPaletteOffset | spPaletteIndex),
+    };
+
+    firstSpriteDrawn = (spPos == 0) && (md == MultiplexerDecision::drawSprite);
+    return multiplexedColors[uint8_t(md)];
+}
+
+// https://www.nesdev.org/wiki/MMC3#IRQ_Specifics
+// A12 rises once per line when the sprite fetches use $1000 and the background $0000, or the other way around
+// at the next line's prefetch. Other setups rise several times a line, which the counter doesn't model.
+uint16_t PPU::scanlineClockCycle() const {
+    if (this->ppuCtrl.backgroundPatternTableAddress && !this->ppuCtrl.spritePatternTableAddress &&
+        !this->ppuCtrl.tallSprites)
+        return 324;
+
+    return 260;
+}
+
+void PPU::clockScanline() {
+    if (this->console.mapper->OnScanline())
+        this->console.cpu->interrupt(Interrupt::IRQ);
+}
+
 void PPU::stepPreRender() {
     // Pre-render scanline (-1 or 261)
     if (this->cycleInScanLine == 1) {
@@ -337,13 +524,14 @@ void PPU::stepPreRender() {
         // idle
     } else if (this->cycleInScanLine <= 256) {
         this->fetchBackgroundTile();
-    } else if (this->cycleInScanLine == 260) {
-        this->console.mapper->OnScanline();
     } else if (this->cycleInScanLine >= 321 && this->cycleInScanLine <= 336) {
         // prefetch for the next line
         this->fetchBackgroundTile();
     }
 
+    if (this->cycleInScanLine == this->scanlineClockCycle())
+        this->clockScanline();
+
     this->updateVRAMAddr();
 }
 
@@ -364,139 +552,39 @@ void PPU::stepVisible() {
             this->secondaryOam.fill(0xff);
         } else if (this->cycleInScanLine == 256) {
             // cycles 65-256: Sprite evaluation
-            auto nextSprite         = 0;
-            const Byte spriteHeight = this->ppuCtrl.tallSprites ? 16 : 8;
-            this->spriteZeroInLine  = false;
-
-            // scan primary sprites, copying ones that are in range to the secondary OAM.
-            // update overflow when > 8 are detected.
             // on a real NES, this is spread out from cycles 65-256, so hopefully
             // this approximation is accurate enough for most games
-            for (size_t idx = 0; idx < 64; idx++) {
-                auto &sprite = this->primarySprites()[idx];
-                if (this->scanLine >= sprite.yPosTop && this->scanLine < (sprite.yPosTop + spriteHeight)) {
-                    // on the current line
-                    if (nextSprite == 8) {
-                        this->status.spriteOverflow = true;
-                        break;
-                    }
-
-
-                    this->spriteZeroInLine |= idx == 0;
-                    this->secondarySprites()[nextSprite] = sprite;
-                    nextSprite++;
-                }
-            }
+            bool overflow               = this->status.spriteOverflow;
+            this->spriteZeroInLine      = evaluateSprites(this->primarySprites(), this->secondarySprites(),
+                                                          this->spritesByLine().lines[this->scanLine], overflow);
+            this->status.spriteOverflow = overflow;
         }
 
         // visible cycle: draw a pixel
         Byte x = this->cycleInScanLine - 1;
         Byte y = this->scanLine;
 
-        // fetch the background pixel
-        // TODO: fix fine X scrolling
-        Byte fineX             = (x % 8) + this->fineXScroll;
-        const TileData &tile   = this->processedTiles[fineX >> 3];
-        Byte tilePaletteIndex  = tile.color(fineX % 8);
-        Byte tilePaletteOffset = (tile.palette & 0x3) << 2;
-
-        // fetch the sprite pixel
-        Byte spPos           = 0;
-        Byte spPaletteIndex  = 0;
-        Byte spPaletteOffset = 0;
-        bool spInBackground  = false;
-
-        for (spPos = 0; spPos < 8; spPos++) {
-            auto &processedSprite = this->processedSprites[spPos];
-            if (!this->ppuMask.showSprites || processedSprite.sprite.empty())
-                break;
-
-            if (x >= processedSprite.sprite.xPosLeft && x < (processedSprite.sprite.xPosLeft + 8)) {
-                auto spX       = x - processedSprite.sprite.xPosLeft;
-                spPaletteIndex = processedSprite.color(spX);
-                if (spPaletteIndex != 0) {
-                    spPaletteOffset = processedSprite.sprite.attributes.palette << 2;
-                    spInBackground  = processedSprite.sprite.attributes.priorityBehindBackground;
-                    break;
-                }
-            }
+        if (this->renderingDeferred) {
+            // the render pool is drawing this frame, so only replay the sprite zero hit it found
+            this->status.spriteZeroHit |= this->spriteZeroHitPixel == y * SCREEN_WIDTH + x;
+        } else {
+            // TODO: fix fine X scrolling
+            Byte fineX            = (x % 8) + this->fineXScroll;
+            const TileData &tile  = this->processedTiles[fineX >> 3];
+            bool firstSpriteDrawn = false;
+            Byte paletteIndex     = compositePixel(this->ppuMask, tile.background(fineX % 8), this->processedSprites, x,
+                                                   firstSpriteDrawn);
+
+            auto color                                 = this->paletteRam[mirrorPalette(paletteIndex)];
+            this->screenBuffers[this->frame & 1][y][x] = outputPixel(this->ppuMask, color);
+            this->status.spriteZeroHit |= this->spriteZeroInLine && firstSpriteDrawn;
         }
 
-        // https://www.nesdev.org/wiki/PPU_rendering#Preface
-        // Priority multiplexer decision table
-        // Implemented as a predefined array to reduce branching
-        enum class MultiplexerDecision {
-            drawBackground = 0,
-            drawTile       = 1,
-            drawSprite     = 2,
-        };
-
-        const static MultiplexerDecision multiplexer[8]{
-                // bg==0, sp==0, priority==X
-                MultiplexerDecision::drawBackground,
-                MultiplexerDecision::drawBackground,
-                // bg==0, sp!=0, priority==X
-                MultiplexerDecision::drawSprite,
-                MultiplexerDecision::drawSprite,
-                // bg!=0, sp==0, priority==X
-                MultiplexerDecision::drawTile,
-                MultiplexerDecision::drawTile,
-                // bg!=0, sp!=0, priority==foreground
-                MultiplexerDecision::drawSprite,
-                // bg!=0, sp!=0, priority==background
-                MultiplexerDecision::drawTile,
-        };
-
-        MultiplexerDecision md =
-                multiplexer[(tilePaletteIndex != 0) << 2 | (spPaletteIndex != 0) << 1 | (spInBackground)];
-        Byte multiplexedColors[3] = {
-                // background
-                0, //
-                // drawTile
-                Byte(tilePaletteOffset | tilePaletteIndex),
-                // drawSprite
-                Byte(0x10 | spPaletteOffset | spPaletteIndex),
-        };
-
-        Byte paletteIndex                          = multiplexedColors[uint8_t(md)];
-
-        auto color                                 = this->paletteRam[mirrorPalette(paletteIndex)];
-        this->screenBuffers[this->frame & 1][y][x] = colorPaletteRGBA[color];
-        this->status.spriteZeroHit |= this->spriteZeroInLine && (spPos == 0) && (md == MultiplexerDecision::drawSprite);
-
         this->fetchBackgroundTile();
-    } else if (this->cycleInScanLine == 260) {
-        this->console.mapper->OnScanline();
     } else if (this->cycleInScanLine == 320) {
         // Cycles 257-320: Sprite fetches (8 sprites total, 8 cycles per sprite).
-        // Find the corresponding tiles for each sprite
-        for (size_t s = 0; s < this->secondarySprites().size(); s++) {
-            auto &processedSprite  = this->processedSprites[s];
-            auto &sprite           = this->secondarySprites()[s];
-
-            processedSprite.sprite = sprite;
-            if (sprite.empty())
-                continue;
-
-            // retrieve the corresponding tile for the sprite
-            Byte spriteHeight = this->ppuCtrl.tallSprites ? 16 : 8;
-            Byte bank = this->ppuCtrl.tallSprites ? sprite.tileIndex.bank : this->ppuCtrl.spritePatternTableAddress;
-            Address patternTableAddress = Address(bank) << 12;
-            Address tileIndex           = sprite.tileIndex.raw & ~Byte(this->ppuCtrl.tallSprites);
-            Byte tileY                  = this->scanLine - sprite.yPosTop;
-
-            tileY                       = sprite.attributes.flipVertical ? (spriteHeight - 1 - tileY) : tileY;
-
-            // tall sprites are stored consecutively, so rewrite the address
-            tileIndex &= ~Byte(this->ppuCtrl.tallSprites);
-            tileIndex += tileY >= 8;
-            tileY &= 0x7;
-
-            processedSprite.tile = {
-                    .patternLow  = this->read(patternTableAddress | (tileIndex << 4) | tileY),
-                    .patternHigh = this->read(patternTableAddress | (tileIndex << 4) | (1 << 3) | tileY),
-            };
-        }
+        fetchSprites(this->secondarySprites(), this->processedSprites, this->scanLine, this->ppuCtrl,
+                     [this](Address addr) { return this->read(addr); });
 
         // 1-4: Read the Y-coordinate, tile number, attributes, and X-coordinate of the selected sprite from secondary OAM
         // 5-8: Read the X-coordinate of the selected sprite from secondary OAM 4 times (while the PPU fetches the sprite tile data)
@@ -506,6 +594,9 @@ void PPU::stepVisible() {
         this->fetchBackgroundTile();
     }
 
+    if (this->cycleInScanLine == this->scanlineClockCycle())
+        this->clockScanline();
+
     this->updateVRAMAddr();
 }
 
@@ -557,6 +648,7 @@ void PPU::updateCycle() {
         this->cycleInScanLine = 0;
 
         if (this->scanLine == 261) {
+            this->finishDeferredRendering();
             this->frame++;
             this->scanLine = 0;
 
@@ -565,6 +657,8 @@ void PPU::updateCycle() {
             // skip the first cycle of a frame when odd + rendering enabled
             this->cycleInScanLine += (this->ppuMask.showBackground | this->ppuMask.showSprites) &
                                      (this->frame & 1); // skip the first cycle for odd frames
+
+            this->beginFrame();
         } else {
             this->scanLine++;
         }
@@ -589,12 +683,381 @@ void PPU::step() {
     }
 }
 
+uint32_t PPU::idleDots() const {
+    // the pre-render line and rendered lines do something on most dots
+    const bool rendering = this->ppuMask.showBackground || this->ppuMask.showSprites;
+    if (this->scanLine == 261 || (this->scanLine <= 239 && rendering))
+        return 0;
+
+    // stop before the dot that sets the vblank flag, and before the pre-render line
+    const uint32_t dot       = this->scanLine * 341 + this->cycleInScanLine;
+    const uint32_t vblankDot = 241 * 341 + 1;
+    return (dot < vblankDot ? vblankDot : 261 * 341) - dot - 1;
+}
+
+void PPU::run(uint32_t dots) {
+    for (;;) {
+        // nothing can change the registers while the CPU waits, so idle dots are skipped all at once
+        if (const uint32_t idle = std::min(this->idleDots(), dots); idle > 0) {
+            const uint32_t dot    = this->scanLine * 341 + this->cycleInScanLine + idle;
+            this->scanLine        = dot / 341;
+            this->cycleInScanLine = dot % 341;
+            dots -= idle;
+        }
+
+        if (dots == 0)
+            return;
+
+        this->step();
+        dots--;
+    }
+}
+
 uint64_t PPU::currentFrame() const {
     return this->frame;
 }
 
 const PPU::Screen &PPU::completedScreen() const {
-    return this->screenBuffers[this->frame & 0x1];
+    // the buffer for the current frame is still being drawn
+    return this->screenBuffers[(this->frame + 1) & 0x1];
+}
+
+void PPU::setRenderThreads(size_t numThreads) {
+    this->finishDeferredRendering();
+
+    if (numThreads == 0) {
+        this->renderPool.reset();
+        this->snapshot.reset();
+        this->backgroundCache.reset();
+        return;
+    }
+
+    this->renderPool      = std::make_unique<ThreadPool>(numThreads);
+    this->snapshot        = std::make_unique<FrameSnapshot>();
+    this->backgroundCache = std::make_unique<BackgroundCache>();
+}
+
+void PPU::copyFrom(PPU &other) {
+    other.finishDeferredRendering();
+
+    this->ppuCtrl             = other.ppuCtrl;
+    this->status              = other.status;
+    this->ppuMask             = other.ppuMask;
+    this->scanLine            = other.scanLine;
+    this->cycleInScanLine     = other.cycleInScanLine;
+    this->frame               = other.frame;
+    this->oam                 = other.oam;
+    this->secondaryOam        = other.secondaryOam;
+    this->paletteRam          = other.paletteRam;
+    this->nametables          = other.nametables;
+    this->processedSprites    = other.processedSprites;
+    this->pendingTile         = other.pendingTile;
+    this->processedTiles      = other.processedTiles;
+    this->spriteZeroInLine    = other.spriteZeroInLine;
+    this->spriteIndex         = other.spriteIndex;
+    this->rasterEffectInFrame = other.rasterEffectInFrame;
+    this->oamAddr             = other.oamAddr;
+    this->bufferedData        = other.bufferedData;
+    this->vramAddr            = other.vramAddr;
+    this->tempVramAddr        = other.tempVramAddr;
+    this->fineXScroll         = other.fineXScroll;
+    this->writeToggle         = other.writeToggle;
+    this->inVBlank            = other.inVBlank;
+    std::memcpy(this->screenBuffers, other.screenBuffers, sizeof(this->screenBuffers));
+}
+
+void PPU::onRasterEffect() {
+    if (this->scanLine > 239)
+        return;
+
+    // lines up to here match the snapshot, and the fetches never stopped, so drawing can pick up from this dot
+    this->rasterEffectInFrame = true;
+    this->finishDeferredRendering();
+}
+
+void PPU::finishDeferredRendering() {
+    if (!this->renderingDeferred)
+        return;
+
+    this->renderPool->wait();
+    this->renderingDeferred = false;
+}
+
+void PPU::beginFrame() {
+    // a frame with a mid-frame split will likely be followed by another one,
+    // so only hand the frame to the pool when the previous frame had no raster effects
+    const bool rendering      = this->ppuMask.showBackground || this->ppuMask.showSprites;
+    const bool drawInPool     = this->renderPool && rendering && !this->rasterEffectInFrame;
+
+    this->rasterEffectInFrame = false;
+    this->spriteZeroHitPixel  = -1;
+
+    if (!drawInPool)
+        return;
+
+    this->takeSnapshot();
+
+    // sprite zero hits are visible to the CPU mid-frame,
+    // so find the first one now instead of waiting on the pool
+    const FrameSnapshot &snap = *this->snapshot;
+    std::array<PaletteIndex, SCREEN_WIDTH> scratch;
+
+    // sprite zero is evaluated on lines top to top + height - 1 and drawn on the line after each,
+    // which caps the lines drawn here at 17 however the frame looks
+    const int top    = snap.sprites[0].yPosTop;
+    const int height = snap.ppuCtrl.tallSprites ? 16 : 8;
+    const int bottom = std::min<int>(top + height, SCREEN_HEIGHT - 1);
+
+    for (int y = top; y <= bottom && this->spriteZeroHitPixel < 0; y++) {
+        bool spriteZeroInLine = (y == 0) ? snap.spriteZeroInFirstLine : snap.spriteZeroEvaluated[y - 1];
+        if (!spriteZeroInLine && !snap.spriteZeroEvaluated[y])
+            continue;
+
+        auto hitX = snap.renderLine(y, scratch.data());
+        if (hitX >= 0)
+            this->spriteZeroHitPixel = y * SCREEN_WIDTH + hitX;
+    }
+
+    auto &screen            = this->screenBuffers[this->frame & 1];
+    const size_t numBands   = 2 * this->renderPool->size();
+    const size_t bandHeight = (SCREEN_HEIGHT + numBands - 1) / numBands;
+
+    this->renderPool->dispatch(numBands, [&snap, &screen, bandHeight](size_t band) {
+        const int end = std::min<int>(SCREEN_HEIGHT, (band + 1) * bandHeight);
+        for (int y = band * bandHeight; y < end; y++)
+            snap.renderLine(y, screen[y]);
+    });
+
+    this->renderingDeferred = true;
+}
+
+void PPU::takeSnapshot() {
+    FrameSnapshot &snap = *this->snapshot;
+
+    for (Address addr = 0; addr < snap.patternTables.size(); addr += 0x400) {
+        if (const Byte *page = this->console.mapper->CHRPage(addr))
+            std::memcpy(&snap.patternTables[addr], page, 0x400);
+        else
+            for (Address offset = addr; offset < addr + 0x400; offset++)
+                snap.patternTables[offset] = this->console.mapper->Read(offset);
+    }
+
+    snap.nametables            = this->nametables;
+    snap.paletteRam            = this->paletteRam;
+    snap.sprites               = this->primarySprites();
+    snap.mirroringMode         = this->console.mapper->cartridge->mirroringMode;
+    snap.ppuCtrl               = this->ppuCtrl;
+    snap.ppuMask               = this->ppuMask;
+    snap.fineXScroll           = this->fineXScroll;
+    snap.firstTiles            = this->processedTiles;
+    snap.lineSprites[0]        = this->processedSprites;
+    snap.spriteZeroInFirstLine = this->spriteZeroInLine;
+
+    // follow v through the frame the same way updateVRAMAddr would
+    VRAMAddress v              = this->vramAddr;
+    for (int y = 0; y < FrameSnapshot::LINES; y++) {
+        snap.lineAddr[y] = v;
+
+        // dots 8, 16, ... 248, then 256 and 257
+        for (int tile = 0; tile < 31; tile++)
+            v.incrementX();
+        v.incrementY();
+        v.copyX(this->tempVramAddr);
+
+        if (y + 1 < FrameSnapshot::LINES)
+            snap.prefetchAddr[y + 1] = v;
+
+        // dots 328 and 336
+        v.incrementX();
+        v.incrementX();
+    }
+
+    // bring the pre-rendered nametables up to date with this frame's tiles
+    this->backgroundCache->update(snap);
+    snap.backgroundCache = this->backgroundCache.get();
+
+    // sprite evaluation on line y selects the sprites drawn on line y + 1
+    const SpriteIndex &index = this->spritesByLine();
+    std::array<Byte, 32> secondaryOam;
+    auto &secondary = *((std::array<Sprite, 8> *) (&secondaryOam));
+    bool overflow   = false;
+
+    for (int y = 0; y < FrameSnapshot::LINES; y++) {
+        secondaryOam.fill(0xff);
+        snap.spriteZeroEvaluated[y] = evaluateSprites(snap.sprites, secondary, index.lines[y], overflow);
+
+        if (y + 1 < FrameSnapshot::LINES)
+            fetchSprites(secondary, snap.lineSprites[y + 1], y, snap.ppuCtrl,
+                         [&snap](Address addr) { return snap.read(addr); });
+    }
+}
+
+Byte FrameSnapshot::read(Address addr) const {
+    if (addr < 0x2000)
+        return this->patternTables[addr];
+    else if (addr < 0x3f00)
+        return this->nametables[mirrorNametable(addr, this->mirroringMode)];
+    else
+        return this->paletteRam[mirrorPalette(addr % 0x20)];
+}
+
+TileData FrameSnapshot::fetchTile(VRAMAddress vramAddr) const {
+    // same fetches as PPU::fetchBackgroundTile, all at once
+    const Address v     = vramAddr.raw;
+    const Address table = this->ppuCtrl.backgroundPatternTableAddress << 12;
+
+    TileData tile;
+    tile.nameTableIndex = this->read(0x2000 | (v & 0x0FFF));
+
+    auto attrAddress    = 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
+    auto attrShift      = (v & 0x40) >> 4 | (v & 0x2);
+    tile.palette        = (this->read(attrAddress) >> attrShift) & 0x3;
+
+    tile.patternLow     = this->read(table | tile.nameTableIndex << 4 | 0 << 3 | vramAddr.fineY);
+    tile.patternHigh    = this->read(table | tile.nameTableIndex << 4 | 1 << 3 | vramAddr.fineY);
+    return tile;
+}
+
+int FrameSnapshot::renderLine(int y, PaletteIndex *out) const {
+    std::array<Byte, PPU::SCREEN_WIDTH> background;
+
+    // the cache can't represent the attribute rows that coarse Y 30 and 31 scroll into,
+    // and line 0 starts from the tiles already latched when the frame began
+    const VRAMAddress &start = this->prefetchAddr[y];
+    if (y > 0 && start.coarseY < 30) {
+        // copy the scroll window out of the pre-rendered nametables, wrapping around horizontally
+        const int cacheX = (start.nameTableSelect & 1) * 256 + start.coarseX * 8 + this->fineXScroll;
+        const int cacheY = (start.nameTableSelect >> 1) * 240 + start.coarseY * 8 + start.fineY;
+        const Byte *row  = &this->backgroundCache->pixels[cacheY * BackgroundCache::WIDTH];
+
+        const int firstSpan = std::min<int>(PPU::SCREEN_WIDTH, BackgroundCache::WIDTH - cacheX);
+        std::memcpy(background.data(), row + cacheX, firstSpan);
+        std::memcpy(background.data() + firstSpan, row, PPU::SCREEN_WIDTH - firstSpan);
+    } else {
+        // every tile that can be shifted in on this line: two from the prefetch, then one every 8 dots
+        std::array<TileData, 33> tiles;
+
+        if (y == 0) {
+            tiles[0] = this->firstTiles[0];
+            tiles[1] = this->firstTiles[1];
+        } else {
+            VRAMAddress v = start;
+            tiles[0]      = this->fetchTile(v);
+            v.incrementX();
+            tiles[1] = this->fetchTile(v);
+        }
+
+        VRAMAddress v = this->lineAddr[y];
+        for (size_t tile = 2; tile < tiles.size(); tile++) {
+            tiles[tile] = this->fetchTile(v);
+            v.incrementX();
+        }
+
+        for (int x = 0; x < PPU::SCREEN_WIDTH; x++) {
+            const int fineX = x + this->fineXScroll;
+            background[x]   = tiles[fineX >> 3].background(fineX % 8);
+        }
+    }
+
+    int spriteZeroHitX = -1;
+    for (int x = 0; x < PPU::SCREEN_WIDTH; x++) {
+        bool firstSpriteDrawn = false;
+        Byte paletteIndex =
+                compositePixel(this->ppuMask, background[x], this->lineSprites[y], Byte(x), firstSpriteDrawn);
+
+        out[x]                = outputPixel(this->ppuMask, this->paletteRam[mirrorPalette(paletteIndex)]);
+
+        // the last dot of a line is drawn after the evaluation for the next line has happened
+        bool spriteZeroInLine = (x == PPU::SCREEN_WIDTH - 1) ? this->spriteZeroEvaluated[y]
+                                : (y == 0)                   ? this->spriteZeroInFirstLine
+                                                             : this->spriteZeroEvaluated[y - 1];
+
+        if (spriteZeroHitX < 0 && spriteZeroInLine && firstSpriteDrawn)
+            spriteZeroHitX = x;
+    }
+
+    return spriteZeroHitX;
+}
+
+void BackgroundCache::invalidate(Address addr, Cartridge::MirroringMode mode) {
+    // a physical nametable shows up in every logical nametable mirrored onto it
+    const Address offset = addr % 0x400;
+    const auto bank      = nameTableMirrorings[uint8_t(mode)][(addr & 0xC00) >> 10];
+
+    for (int nameTable = 0; nameTable < 4; nameTable++) {
+        if (nameTableMirrorings[uint8_t(mode)][nameTable] != bank)
+            continue;
+
+        const int baseX = (nameTable & 1) * 32;
+        const int baseY = (nameTable >> 1) * 30;
+
+        if (offset < 0x3c0) {
+            this->dirty[(baseY + offset / 32) * TILES_X + baseX + offset % 32] = true;
+        } else {
+            // each attribute byte covers 4x4 tiles
+            const int attrX = (offset - 0x3c0) % 8 * 4;
+            const int attrY = (offset - 0x3c0) / 8 * 4;
+
+            for (int tileY = attrY; tileY < std::min(attrY + 4, 30); tileY++)
+                for (int tileX = attrX; tileX < attrX + 4; tileX++)
+                    this->dirty[(baseY + tileY) * TILES_X + baseX + tileX] = true;
+        }
+    }
+}
+
+void BackgroundCache::update(const FrameSnapshot &snap) {
+    const Address table = snap.ppuCtrl.backgroundPatternTableAddress << 12;
+
+    // switching pattern tables or mirroring changes every tile
+    if (table != this->patternTable || snap.mirroringMode != this->mirroringMode) {
+        this->dirty.set();
+        this->patternTable  = table;
+        this->mirroringMode = snap.mirroringMode;
+    } else {
+        // CHR-RAM writes and bank switches: redraw the tiles that use a pattern that changed
+        std::bitset<256> changedPatterns;
+        for (size_t pattern = 0; pattern < 256; pattern++)
+            changedPatterns[pattern] =
+                    std::memcmp(&this->patterns[pattern * 16], &snap.patternTables[table | pattern * 16], 16) != 0;
+
+        if (changedPatterns.any())
+            for (size_t tile = 0; tile < this->tileIndices.size(); tile++)
+                if (changedPatterns[this->tileIndices[tile]])
+                    this->dirty[tile] = true;
+    }
+
+    std::memcpy(this->patterns.data(), &snap.patternTables[table], this->patterns.size());
+
+    if (this->dirty.none())
+        return;
+
+    for (int tileY = 0; tileY < TILES_Y; tileY++) {
+        for (int tileX = 0; tileX < TILES_X; tileX++) {
+            if (!this->dirty[tileY * TILES_X + tileX])
+                continue;
+
+            // the v that would fetch this tile at fine Y 0
+            VRAMAddress v;
+            v.raw             = 0;
+            v.coarseX         = tileX % 32;
+            v.coarseY         = tileY % 30;
+            v.nameTableSelect = (tileY / 30) << 1 | (tileX / 32);
+
+            TileData tile     = snap.fetchTile(v);
+            this->tileIndices[tileY * TILES_X + tileX] = tile.nameTableIndex;
+
+            for (int fineY = 0; fineY < 8; fineY++) {
+                tile.patternLow  = this->patterns[tile.nameTableIndex << 4 | 0 << 3 | fineY];
+                tile.patternHigh = this->patterns[tile.nameTableIndex << 4 | 1 << 3 | fineY];
+
+                Byte *row        = &this->pixels[(tileY * 8 + fineY) * WIDTH + tileX * 8];
+                for (int x = 0; x < 8; x++)
+                    row[x] = tile.background(x);
+            }
+        }
+    }
+
+    this->dirty.reset();
 }
 
 } // namespace nes
\ No newline at end of file
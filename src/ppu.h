@@ -1,6 +1,7 @@
 #pragma once
 #include "console.h"
 #include "nes.h"
+#include "palette.h"
 
 namespace nes {
 
@@ -112,6 +113,7 @@ struct TileData {
     Byte patternHigh;
 
     Byte color(uint8_t x) const;
+    Byte background(uint8_t x) const;
 };
 
 struct ProcessedSprite {
@@ -121,6 +123,20 @@ struct ProcessedSprite {
     Byte color(uint8_t x) const;
 };
 
+// Which sprites cover each line, so the evaluation at dot 256 doesn't have to scan all of OAM.
+// Rebuilt only after OAM or the sprite height changes, which is usually once per frame at most.
+struct SpriteIndex {
+    std::array<uint64_t, 256> lines; // bit n is set when sprite n is in range of the line
+    bool tallSprites = false;
+    bool stale       = true;
+
+    void rebuild(const std::array<Sprite, 64> &sprites, bool tall);
+};
+
+class ThreadPool;
+struct FrameSnapshot;
+struct BackgroundCache;
+
 static_assert(sizeof(PPUCTRL) == 1);
 static_assert(sizeof(PPUMASK) == 1);
 static_assert(sizeof(PPUSTATUS) == 1);
@@ -133,10 +149,14 @@ public:
     static const int SCREEN_WIDTH  = 256;
     static const int SCREEN_HEIGHT = 240;
 
-    // Note that this is indexed by screen[y][x]
-    using Screen = uint32_t[SCREEN_HEIGHT][SCREEN_WIDTH];
+    // Note that this is indexed by screen[y][x], see PixelConverter to get colors
+    using Screen = PaletteIndex[SCREEN_HEIGHT][SCREEN_WIDTH];
 
+#ifdef _NES_TEST
+public:
+#else
 private:
+#endif
     Console &console;
     PPUCTRL ppuCtrl                   = {.raw = 0};
     PPUSTATUS status                  = {.raw = 0};
@@ -148,12 +168,21 @@ private:
     std::array<Byte, 32> secondaryOam = {0}; // up to 8 sprites on the current line
     std::array<Byte, 32> paletteRam   = {0};
     std::array<Byte, 2048> nametables = {0};
-    std::array<ProcessedSprite, 8> processedSprites; // after secondary is populated and tiles are fetched
-    TileData pendingTile;
-    std::array<TileData, 2> processedTiles;
+    std::array<ProcessedSprite, 8> processedSprites{}; // after secondary is populated and tiles are fetched
+    TileData pendingTile{};
+    std::array<TileData, 2> processedTiles{};
     bool spriteZeroInLine = false;
+    SpriteIndex spriteIndex;
     Screen screenBuffers[2];
 
+    // frames without raster effects are drawn from a snapshot on the render pool, see beginFrame
+    std::unique_ptr<ThreadPool> renderPool;
+    std::unique_ptr<FrameSnapshot> snapshot;
+    std::unique_ptr<BackgroundCache> backgroundCache;
+    bool renderingDeferred     = false;
+    bool rasterEffectInFrame   = false;
+    int32_t spriteZeroHitPixel = -1; // y * SCREEN_WIDTH + x
+
     Byte oamAddr             = 0;
     Byte bufferedData        = 0;
     VRAMAddress vramAddr     = {.raw = 0};
@@ -166,13 +195,26 @@ private:
     void write(Address addr, Byte data);
 
 
+    uint16_t scanlineClockCycle() const;
+    void clockScanline();
+
     void stepVisible();
     void stepPreRender();
     void stepPostRender();
     void stepVBlank();
 
+    const SpriteIndex &spritesByLine();
+
+    // dots after the current one in which step() would only advance the beam
+    uint32_t idleDots() const;
+
+    void beginFrame();
+    void takeSnapshot();
+    void finishDeferredRendering();
+
 public:
     PPU(Console &c);
+    ~PPU();
 
     std::array<Sprite, 64> &primarySprites();
     std::array<Sprite, 8> &secondarySprites();
@@ -184,10 +226,80 @@ public:
     void writeRegister(Address addr, Byte data);
     void writeDMA(const Byte *page);
     void step();
+    // step through dots, skipping over the ones that only move the beam in one go
+    void run(uint32_t dots);
     void updateCycle();
     void updateVRAMAddr();
     void fetchBackgroundTile();
     void reset();
+
+    // draw frames on numThreads workers when nothing changes mid-frame. 0 renders every pixel inline.
+    void setRenderThreads(size_t numThreads);
+
+    // called before anything that changes rendering (register, OAM or bank writes) takes effect
+    void onRasterEffect();
+
+    // the state of another console's PPU, for a cloned console. Waits for the other's frame to be drawn,
+    // the clone draws every pixel inline until it gets render threads of its own.
+    void copyFrom(PPU &other);
+};
+
+// Everything needed to draw the visible lines of a frame, captured at the start of the frame.
+// Only valid as long as nothing that affects rendering is written during the visible lines.
+struct FrameSnapshot {
+    static const int LINES = PPU::SCREEN_HEIGHT;
+
+    std::array<Byte, 0x2000> patternTables;
+    std::array<Byte, 2048> nametables;
+    std::array<Byte, 32> paletteRam;
+    std::array<Sprite, 64> sprites;
+    Cartridge::MirroringMode mirroringMode;
+    PPUCTRL ppuCtrl;
+    PPUMASK ppuMask;
+    Byte fineXScroll;
+
+    // tiles already in the shift registers for line 0
+    std::array<TileData, 2> firstTiles;
+    // v at the start of the prefetch (dot 321 of the previous line), and at dot 1 of each line
+    std::array<VRAMAddress, LINES> prefetchAddr;
+    std::array<VRAMAddress, LINES> lineAddr;
+
+    // sprites drawn on each line, and whether the evaluation at dot 256 of each line found sprite zero
+    std::array<std::array<ProcessedSprite, 8>, LINES> lineSprites;
+    std::array<bool, LINES> spriteZeroEvaluated;
+    bool spriteZeroInFirstLine;
+
+    const BackgroundCache *backgroundCache;
+
+    Byte read(Address addr) const;
+    TileData fetchTile(VRAMAddress v) const;
+
+    // draw a line into out, returning the x of the first sprite zero hit or -1
+    int renderLine(int y, PaletteIndex *out) const;
+};
+
+// The four logical nametables drawn as one 512x480 background, one byte per pixel (attribute palette << 2 | color).
+// Kept up to date a tile at a time, so frames drawn from a snapshot can copy their scroll window out of it.
+struct BackgroundCache {
+    static const int WIDTH   = 512;
+    static const int HEIGHT  = 480;
+    static const int TILES_X = WIDTH / 8;
+    static const int TILES_Y = HEIGHT / 8;
+
+    std::array<Byte, WIDTH * HEIGHT> pixels;
+
+    // what the pixels were drawn from
+    std::array<Byte, TILES_X * TILES_Y> tileIndices;
+    std::array<Byte, 0x1000> patterns;
+    Address patternTable                  = 0;
+    Cartridge::MirroringMode mirroringMode = Cartridge::MirroringMode::Horizontal;
+    std::bitset<TILES_X * TILES_Y> dirty  = std::bitset<TILES_X * TILES_Y>().set();
+
+    // a nametable or attribute byte was written
+    void invalidate(Address addr, Cartridge::MirroringMode mode);
+
+    // redraw every tile that was invalidated or whose pattern changed since the last frame
+    void update(const FrameSnapshot &snap);
 };
 
 } // namespace nes
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+#include "nes.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+
+namespace nes {
+
+// A lock-free ring between exactly one producer thread and one consumer thread,
+// such as the emulation thread and the audio device callback.
+template<typename T>
+class SPSCRing {
+private:
+    std::vector<T> items;
+    size_t mask;
+
+    // only ever increase, wrapping around through the mask. Kept on separate cache lines.
+    alignas(64) std::atomic<size_t> readIndex{0};
+    alignas(64) std::atomic<size_t> writeIndex{0};
+
+public:
+    // the capacity is rounded up to a power of two
+    explicit SPSCRing(size_t capacity) :
+        items(std::bit_ceil(capacity)), mask(std::bit_ceil(capacity) - 1) {
+    }
+
+    size_t capacity() const {
+        return this->items.size();
+    }
+
+    size_t size() const {
+        return this->writeIndex.load(std::memory_order_acquire) - this->readIndex.load(std::memory_order_acquire);
+    }
+
+    // producer: append one item, false when the ring is full
+    bool push(const T &item) {
+        const size_t write = this->writeIndex.load(std::memory_order_relaxed);
+        const size_t read  = this->readIndex.load(std::memory_order_acquire);
+        if (write - read == this->capacity())
+            return false;
+
+        this->items[write & this->mask] = item;
+        this->writeIndex.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    // producer: append up to n items, returning how many fit
+    size_t push(const T *in, size_t n) {
+        const size_t write = this->writeIndex.load(std::memory_order_relaxed);
+        const size_t read  = this->readIndex.load(std::memory_order_acquire);
+        n                  = std::min(n, this->capacity() - (write - read));
+
+        // the free space may wrap around the end of the buffer
+        const size_t start = write & this->mask;
+        const size_t first = std::min(n, this->capacity() - start);
+        std::copy_n(in, first, this->items.data() + start);
+        if (first < n)
+            std::copy_n(in + first, n - first, this->items.data());
+
+        this->writeIndex.store(write + n, std::memory_order_release);
+        return n;
+    }
+
+    // consumer: remove up to n items, returning how many were available
+    size_t pop(T *out, size_t n) {
+        const size_t read  = this->readIndex.load(std::memory_order_relaxed);
+        const size_t write = this->writeIndex.load(std::memory_order_acquire);
+        n                  = std::min(n, write - read);
+
+        const size_t start = read & this->mask;
+        const size_t first = std::min(n, this->capacity() - start);
+        std::copy_n(this->items.data() + start, first, out);
+        if (first < n)
+            std::copy_n(this->items.data(), n - first, out + first);
+
+        this->readIndex.store(read + n, std::memory_order_release);
+        return n;
+    }
+};
+
+using AudioRing = SPSCRing<float>;
+
+} // namespace nes
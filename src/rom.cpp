@@ -1,11 +1,24 @@
 #include "rom.h"
 #include "cartridge.h"
+#include <algorithm>
+#include <cstring>
 #include <errno.h>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace nes {
 
 // https://www.nesdev.org/wiki/INES
@@ -99,59 +112,268 @@ union anyHeader {
 };
 
 
+// A cartridge already parsed by WriteRomCache, for loading without parsing or copying.
+// Native byte order, PRG and CHR at page-aligned offsets.
+struct cacheHeader {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint16_t mapperType;
+    uint8_t mirroringMode;
+    uint8_t hasBattery;
+    uint64_t prgRAMSize;
+    uint64_t chrRAMSize; // 0 for CHR ROM
+    uint64_t prgOffset;
+    uint64_t prgSize;
+    uint64_t chrOffset;
+    uint64_t chrSize;
+    uint64_t prgFileOffset; // in the iNES file, for patches
+};
+
+const std::array<char, 8> cacheMagic{'N', 'E', 'S', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t cacheVersion = 3;
+const size_t cachePageSize  = 4096;
+const size_t cacheMaxRAM    = 2 * (size_t(64) << 15); // PRG RAM and NVRAM as large as a NES 2.0 header can ask
+
 static_assert(sizeof(inesHeader) == 16, "unexpected inesHeader size");
 static_assert(sizeof(nes2Header) == 16, "unexpected nes2Header size");
 static_assert(sizeof(anyHeader) == 16, "unexpected anyHeader size");
+static_assert(sizeof(cacheHeader) == 72, "unexpected cacheHeader size");
 
-std::unique_ptr<Mapper> LoadRomFile(const std::string &path) {
-    auto cartridge = std::make_unique<Cartridge>();
+RomImage::~RomImage() {
+#ifndef _WIN32
+    if (this->data != nullptr && this->copy.empty())
+        munmap(const_cast<Byte *>(this->data), this->size);
+#endif
+}
 
-    std::ifstream romFile(path, std::ios_base::binary | std::ios_base::in);
-    anyHeader hdr;
+std::span<const Byte> RomImage::bytes() const {
+    return {this->data, this->size};
+}
 
-    if (!romFile.is_open()) {
+std::shared_ptr<const RomImage> RomImage::Open(const std::string &path) {
+    static std::mutex cacheMutex;
+    static std::map<std::string, std::weak_ptr<const RomImage>> cache;
+
+    std::shared_ptr<RomImage> image(new RomImage());
+    std::string key = path;
+
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0)
+            close(fd);
         throw std::runtime_error(std::string("failed to open: ") + path);
     }
 
-    // read directly into the inesHeader
-    char rawHeader[16];
-    romFile.read(&rawHeader[0], sizeof(hdr));
-    romFile.seekg(0);
+    // the same file under any path, remapped when it was modified in place
+    key = std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":" +
+          std::to_string(st.st_mtime);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (auto cached = cache[key].lock()) {
+        close(fd);
+        return cached;
+    }
+
+    void *mapped = st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (mapped != MAP_FAILED) {
+        image->data = static_cast<const Byte *>(mapped);
+        image->size = st.st_size;
+    }
+#else
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (auto cached = cache[key].lock())
+        return cached;
+#endif
+
+    if (image->data == nullptr) {
+        std::ifstream romFile(path, std::ios_base::binary | std::ios_base::in);
+        if (!romFile.is_open())
+            throw std::runtime_error(std::string("failed to open: ") + path);
+
+        image->copy.assign(std::istreambuf_iterator<char>(romFile), std::istreambuf_iterator<char>());
+        image->data = image->copy.data();
+        image->size = image->copy.size();
+    }
 
+    // forget the images nobody uses anymore
+    std::erase_if(cache, [](const auto &entry) { return entry.second.expired(); });
+    cache[key] = image;
+    return image;
+}
+
+// NES 2.0 sizes in 16/8 KB units, or 2^E * (M * 2 + 1) bytes when the high nibble is $F.
+// Sizes too large for a size_t come out as SIZE_MAX, which no file is large enough for.
+static size_t nes2RomSize(uint8_t lo, uint8_t hi, size_t unit) {
+    if (hi != 0xF)
+        return (size_t(hi) << 8 | lo) * unit;
+
+    const int exponent   = lo >> 2;
+    const size_t factor  = (lo & 0x3) * 2 + 1;
+    const size_t largest = std::numeric_limits<size_t>::max();
+    if (exponent >= std::numeric_limits<size_t>::digits || factor > largest >> exponent)
+        return largest;
+    return factor << exponent;
+}
 
-    romFile.read(reinterpret_cast<char *>(&hdr), sizeof(hdr));
+RomLayout ParseRomHeader(std::span<const Byte> file, const std::string &path) {
+    anyHeader hdr;
+    if (file.size() < sizeof(hdr))
+        throw std::runtime_error("Not a valid NES file");
+
+    // read directly into the inesHeader
+    std::memcpy(&hdr, file.data(), sizeof(hdr));
     if (hdr.ines.magic != expectedMagic)
         throw std::runtime_error("Not a valid NES file");
 
-    bool isNES2_0 = hdr.nes2.nes2_0 == 0x2;
-    if (isNES2_0)
-        printf("TODO: support NES 2.0\n");
+    RomLayout layout;
+    layout.isNES2     = hdr.nes2.nes2_0 == 0x2;
+    layout.hasBattery = hdr.ines.hasBattery;
 
     if (hdr.ines.fourScreenMirror)
-        cartridge->mirroringMode = Cartridge::MirroringMode::FourScreen;
+        layout.mirroringMode = Cartridge::MirroringMode::FourScreen;
     else
-        cartridge->mirroringMode = Cartridge::MirroringMode(hdr.ines.mirrorMode);
+        layout.mirroringMode = Cartridge::MirroringMode(hdr.ines.mirrorMode);
 
     // skip over the trainer for now
-    if (hdr.ines.hasTrainer)
-        romFile.seekg(romFile.tellg() * 512);
+    layout.prgOffset = sizeof(hdr) + (hdr.ines.hasTrainer ? 512 : 0);
 
-    // read PRG ROM
-    cartridge->prgROM.resize(hdr.ines.prgRomSize * 16384);
-    romFile.read(reinterpret_cast<char *>(cartridge->prgROM.data()), cartridge->prgROM.size());
+    if (layout.isNES2) {
+        layout.mapperType = MapperType(hdr.nes2.mapperHi << 8 | hdr.nes2.mapperMid << 4 | hdr.nes2.mapperLo);
+        layout.prgSize    = nes2RomSize(hdr.nes2.prgRomSizeLo, hdr.nes2.prgRomSizeHi, 16384);
+        layout.chrSize    = nes2RomSize(hdr.nes2.chrSizeLo, hdr.nes2.chrRomSizeHi, 8192);
 
-    // read CHR ROM
-    if (hdr.ines.chrRomSize > 0) {
-        cartridge->chrROM.resize(hdr.ines.chrRomSize * 8192);
-        romFile.read(reinterpret_cast<char *>(cartridge->chrROM.data()), cartridge->chrROM.size());
+        // volatile and battery-backed together, never less than the 8 KB at $6000-$7FFF
+        size_t ramSize = 0;
+        if (hdr.nes2.prgRamShiftCount)
+            ramSize += size_t(64) << hdr.nes2.prgRamShiftCount;
+        if (hdr.nes2.prgNVRAMShiftCount)
+            ramSize += size_t(64) << hdr.nes2.prgNVRAMShiftCount;
+        layout.prgRAMSize = std::max<size_t>(ramSize, 8192);
+    } else {
+        layout.mapperType = MapperType(hdr.ines.mapperHi << 4 | hdr.ines.mapperLo);
+        layout.prgSize    = hdr.ines.prgRomSize * 16384;
+        layout.chrSize    = hdr.ines.chrRomSize * 8192;
+        layout.prgRAMSize = size_t(hdr.ines.prgRamSize ?: 1) << 13;
+    }
+
+    // mappers bank PRG ROM in 16 KB units
+    if (layout.prgSize == 0 || layout.prgSize % 16384 != 0)
+        throw std::runtime_error(std::string("invalid PRG ROM size in NES file: ") + path);
+
+    // compared against what's left of the file, as the sizes can be anything up to SIZE_MAX
+    if (layout.prgOffset > file.size() || layout.prgSize > file.size() - layout.prgOffset ||
+        layout.chrSize > file.size() - layout.prgOffset - layout.prgSize)
+        throw std::runtime_error(std::string("truncated NES file: ") + path);
+
+    layout.chrOffset = layout.prgOffset + layout.prgSize;
+
+    return layout;
+}
+
+static MapperType loadINES(Cartridge &cartridge, const std::string &path) {
+    auto file   = cartridge.image->bytes();
+    auto layout = ParseRomHeader(file, path);
+
+    cartridge.mirroringMode = layout.mirroringMode;
+    cartridge.hasBattery    = layout.hasBattery;
+    cartridge.prgFileOffset = layout.prgOffset;
+
+    // PRG and CHR ROM are views into the image, nothing is copied
+    cartridge.prgROM = file.subspan(layout.prgOffset, layout.prgSize);
+
+    if (layout.chrSize > 0) {
+        cartridge.chrROM = file.subspan(layout.chrOffset, layout.chrSize);
     } else {
         // uses CHR RAM
-        cartridge->chrROM.resize(8192);
+        cartridge.chrRAM.resize(8192);
     }
 
-    // read prgRAM
-    cartridge->prgRAM.resize(size_t(hdr.ines.prgRamSize ?: 1) << 13);
+    cartridge.prgRAM.resize(layout.prgRAMSize);
+    return layout.mapperType;
+}
+
+static MapperType loadCache(Cartridge &cartridge, const std::string &path) {
+    auto file = cartridge.image->bytes();
+
+    // the magic only says which emulator wrote it, the header can still be corrupt or from another version
+    cacheHeader hdr;
+    std::memcpy(&hdr, file.data(), sizeof(hdr));
+    if (hdr.version != cacheVersion || hdr.prgSize > file.size() || hdr.prgOffset > file.size() - hdr.prgSize ||
+        hdr.chrSize > file.size() || hdr.chrOffset > file.size() - hdr.chrSize)
+        throw std::runtime_error(std::string("invalid or outdated ROM cache: ") + path);
+
+    // the PPU indexes its mirroring table with the mode, and mappers bank PRG ROM in 16 KB units
+    if (hdr.mirroringMode > uint8_t(Cartridge::MirroringMode::FourScreen) || hdr.prgSize == 0 ||
+        hdr.prgSize % 16384 != 0 || hdr.prgRAMSize > cacheMaxRAM || hdr.chrRAMSize > cacheMaxRAM)
+        throw std::runtime_error(std::string("invalid ROM cache: ") + path);
+
+    cartridge.mirroringMode = Cartridge::MirroringMode(hdr.mirroringMode);
+    cartridge.hasBattery    = hdr.hasBattery;
+    cartridge.prgFileOffset = hdr.prgFileOffset;
+    cartridge.prgROM        = file.subspan(hdr.prgOffset, hdr.prgSize);
+
+    if (hdr.chrRAMSize > 0) {
+        cartridge.chrRAM.resize(hdr.chrRAMSize);
+    } else {
+        cartridge.chrROM = file.subspan(hdr.chrOffset, hdr.chrSize);
+    }
+
+    cartridge.prgRAM.resize(hdr.prgRAMSize);
+    return MapperType(hdr.mapperType);
+}
+
+static bool isCache(std::span<const Byte> file) {
+    return file.size() >= sizeof(cacheHeader) && std::memcmp(file.data(), cacheMagic.data(), cacheMagic.size()) == 0;
+}
+
+std::unique_ptr<Mapper> LoadRomFile(const std::string &path) {
+    auto cartridge   = std::make_unique<Cartridge>();
+    cartridge->image = RomImage::Open(path);
+
+    auto mapperType = isCache(cartridge->image->bytes()) ? loadCache(*cartridge, path) : loadINES(*cartridge, path);
+    return Mapper::Create(mapperType, std::move(cartridge));
+}
+
+void WriteRomCache(const std::string &romPath, const std::string &cachePath) {
+    Cartridge cartridge;
+    cartridge.image = RomImage::Open(romPath);
+    if (isCache(cartridge.image->bytes()))
+        throw std::runtime_error(std::string("already a ROM cache: ") + romPath);
+
+    const MapperType mapperType = loadINES(cartridge, romPath);
+    const bool hasCHRRAM        = !cartridge.chrRAM.empty();
+
+    cacheHeader hdr{};
+    hdr.magic         = cacheMagic;
+    hdr.version       = cacheVersion;
+    hdr.mapperType    = uint16_t(mapperType);
+    hdr.mirroringMode = uint8_t(cartridge.mirroringMode);
+    hdr.hasBattery    = cartridge.hasBattery;
+    hdr.prgRAMSize    = cartridge.prgRAM.size();
+    hdr.chrRAMSize    = hasCHRRAM ? cartridge.chrRAM.size() : 0;
+    hdr.prgOffset     = cachePageSize;
+    hdr.prgSize       = cartridge.prgROM.size();
+    hdr.chrOffset     = hdr.prgOffset + (hdr.prgSize + cachePageSize - 1) / cachePageSize * cachePageSize;
+    hdr.chrSize       = hasCHRRAM ? 0 : cartridge.chrROM.size();
+    hdr.prgFileOffset = cartridge.prgFileOffset;
+
+    std::ofstream cacheFile(cachePath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    if (!cacheFile.is_open())
+        throw std::runtime_error(std::string("failed to open: ") + cachePath);
+
+    // everything at page-aligned offsets, so the views into the mapping are aligned too
+    const std::vector<char> padding(cachePageSize, 0);
+    cacheFile.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+    cacheFile.write(padding.data(), hdr.prgOffset - sizeof(hdr));
+    cacheFile.write(reinterpret_cast<const char *>(cartridge.prgROM.data()), hdr.prgSize);
+    cacheFile.write(padding.data(), hdr.chrOffset - hdr.prgOffset - hdr.prgSize);
+    cacheFile.write(reinterpret_cast<const char *>(cartridge.chrROM.data()), hdr.chrSize);
 
-    return Mapper::Create(MapperType(hdr.ines.mapperHi << 4 | hdr.ines.mapperLo), std::move(cartridge));
+    if (!cacheFile)
+        throw std::runtime_error(std::string("failed to write: ") + cachePath);
 }
-} // namespace nes
\ No newline at end of file
+} // namespace nes
@@ -4,5 +4,46 @@
 
 namespace nes {
 
+// A ROM file mapped read-only. Every cartridge loaded from the same file in a process shares one mapping,
+// and the page cache shares it between processes.
+class RomImage {
+private:
+    const Byte *data = nullptr;
+    size_t size      = 0;
+    std::vector<Byte> copy; // where files can't be mapped
+
+    RomImage() = default;
+
+public:
+    static std::shared_ptr<const RomImage> Open(const std::string &path);
+    ~RomImage();
+
+    RomImage(const RomImage &)            = delete;
+    RomImage &operator=(const RomImage &) = delete;
+
+    std::span<const Byte> bytes() const;
+};
+
+// Where a cartridge's parts are in an iNES or NES 2.0 file, and what it needs from the console
+struct RomLayout {
+    MapperType mapperType;
+    Cartridge::MirroringMode mirroringMode;
+    bool isNES2;
+    bool hasBattery;
+    size_t prgOffset;
+    size_t prgSize;
+    size_t chrOffset;
+    size_t chrSize; // 0 for boards with CHR RAM
+    size_t prgRAMSize;
+};
+
+// Throws when the file isn't an iNES file, is shorter than its header says or has no whole 16 KB PRG ROM banks
+RomLayout ParseRomHeader(std::span<const Byte> file, const std::string &path);
+
+// Loads iNES files and ROM caches written by WriteRomCache
 std::unique_ptr<Mapper> LoadRomFile(const std::string &path);
+
+// Parse an iNES file once and write it as a cache that LoadRomFile maps without parsing or copying.
+// Caches are tied to this build of the emulator and rejected when their version doesn't match.
+void WriteRomCache(const std::string &romPath, const std::string &cachePath);
 }
\ No newline at end of file
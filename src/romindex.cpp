@@ -0,0 +1,318 @@
+#include "romindex.h"
+#include "cartridge.h"
+#include "rom.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+
+namespace nes {
+
+// https://en.wikipedia.org/wiki/Cyclic_redundancy_check, the zlib polynomial used by ROM databases.
+// Slicing-by-8: table t[k] advances a byte that is k bytes further from the end, so 8 bytes take 8 lookups.
+static constexpr auto crcTables = [] {
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0u - (crc & 1)));
+        tables[0][i] = crc;
+    }
+
+    for (size_t t = 1; t < tables.size(); t++)
+        for (uint32_t i = 0; i < 256; i++)
+            tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFF];
+
+    return tables;
+}();
+
+uint32_t CRC32(std::span<const Byte> data) {
+    const auto &t = crcTables;
+    const Byte *p = data.data();
+    size_t n      = data.size();
+    uint32_t crc  = 0xFFFFFFFF;
+
+    for (; n >= 8; n -= 8, p += 8) {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24);
+        uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | uint32_t(p[7]) << 24;
+        crc         = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+
+    for (; n > 0; n--, p++)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+
+    return ~crc;
+}
+
+// https://www.rfc-editor.org/rfc/rfc3174
+static void sha1Block(std::array<uint32_t, 5> &h, const Byte *block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+        w[i] = uint32_t(block[4 * i]) << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+    for (int i = 16; i < 80; i++)
+        w[i] = std::rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        uint32_t temp = std::rotl(a, 5) + f + e + k + w[i];
+        e             = d;
+        d             = c;
+        c             = std::rotl(b, 30);
+        b             = a;
+        a             = temp;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+std::array<Byte, 20> SHA1(std::span<const Byte> data) {
+    std::array<uint32_t, 5> h{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+    const size_t whole = data.size() / 64 * 64;
+    for (size_t i = 0; i < whole; i += 64)
+        sha1Block(h, data.data() + i);
+
+    // the rest, the terminating 1 bit and the length in bits fill one or two more blocks
+    Byte tail[128]  = {0};
+    const size_t n  = data.size() - whole;
+    const size_t to = n + 9 <= 64 ? 64 : 128;
+    if (n > 0)
+        std::memcpy(tail, data.data() + whole, n);
+    tail[n] = 0x80;
+
+    const uint64_t bits = uint64_t(data.size()) * 8;
+    for (int i = 0; i < 8; i++)
+        tail[to - 1 - i] = Byte(bits >> (8 * i));
+
+    for (size_t i = 0; i < to; i += 64)
+        sha1Block(h, tail + i);
+
+    std::array<Byte, 20> digest;
+    for (int i = 0; i < 20; i++)
+        digest[i] = Byte(h[i / 4] >> (24 - 8 * (i % 4)));
+    return digest;
+}
+
+// Native byte order, records then the paths they point into
+struct indexHeader {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t count;
+    uint64_t pathsSize;
+};
+
+struct indexRecord {
+    std::array<Byte, 20> sha1;
+    uint32_t crc32;
+    uint16_t mapper;
+    uint16_t flags;
+    uint32_t prgSize;
+    uint32_t chrSize;
+    uint32_t pathOffset;
+    uint32_t pathSize;
+};
+
+enum IndexFlags : uint16_t {
+    Supported  = 1 << 0,
+    NES2       = 1 << 1,
+    HasBattery = 1 << 2,
+};
+
+const std::array<char, 8> indexMagic{'N', 'E', 'S', 'I', 'N', 'D', 'E', 'X'};
+const uint32_t indexVersion = 1;
+
+static_assert(sizeof(indexHeader) == 24, "unexpected indexHeader size");
+static_assert(sizeof(indexRecord) == 44, "unexpected indexRecord size");
+
+static std::string normalPath(const std::string &path) {
+    return std::filesystem::path(path).lexically_normal().string();
+}
+
+static RomIndexEntry indexRom(const std::string &path) {
+    auto image  = RomImage::Open(path);
+    auto file   = image->bytes();
+    auto layout = ParseRomHeader(file, path);
+
+    // PRG and CHR are next to each other, so both hash in one pass
+    auto rom = file.subspan(layout.prgOffset, layout.prgSize + layout.chrSize);
+
+    RomIndexEntry entry;
+    entry.path       = path;
+    entry.crc32      = CRC32(rom);
+    entry.sha1       = SHA1(rom);
+    entry.mapper     = uint16_t(layout.mapperType);
+    entry.prgSize    = uint32_t(layout.prgSize);
+    entry.chrSize    = uint32_t(layout.chrSize);
+    entry.isNES2     = layout.isNES2;
+    entry.hasBattery = layout.hasBattery;
+    entry.supported  = Mapper::IsSupported(layout.mapperType);
+    return entry;
+}
+
+void RomIndex::add(RomIndexEntry &&entry) {
+    const size_t i = this->entries.size();
+    this->byPath[entry.path] = i;
+    this->bySHA1.emplace(std::string(entry.sha1.begin(), entry.sha1.end()), i);
+    this->entries.push_back(std::move(entry));
+}
+
+RomIndex RomIndex::Build(const std::string &dir, size_t numThreads) {
+    namespace fs = std::filesystem;
+
+    std::vector<std::string> paths;
+    auto options = fs::directory_options::skip_permission_denied;
+    for (auto it = fs::recursive_directory_iterator(dir, options); it != fs::recursive_directory_iterator(); ++it) {
+        std::string ext = it->path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+
+        // entries that can't be looked at, like broken links, are skipped instead of ending the scan
+        std::error_code err;
+        if (ext == ".nes" && it->is_regular_file(err) && !err)
+            paths.push_back(normalPath(it->path().string()));
+    }
+
+    // the same index for the same tree, however the directory lists it
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<RomIndexEntry> entries(paths.size());
+    std::vector<std::optional<std::string>> errors(paths.size());
+    ThreadPool pool(numThreads > 0 ? numThreads - 1 : 0);
+
+    pool.parallelFor(paths.size(), [&paths, &entries, &errors](size_t i) {
+        try {
+            entries[i] = indexRom(paths[i]);
+        } catch (std::exception &exc) {
+            // anything escaping a pool thread would terminate the whole scan
+            errors[i] = exc.what();
+        }
+    });
+
+    RomIndex index;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (errors[i])
+            std::cerr << paths[i] << ": " << *errors[i] << std::endl;
+        else
+            index.add(std::move(entries[i]));
+    }
+
+    return index;
+}
+
+RomIndex RomIndex::Load(const std::string &indexPath) {
+    std::ifstream indexFile(indexPath, std::ios_base::binary | std::ios_base::in);
+    if (!indexFile.is_open())
+        throw std::runtime_error(std::string("failed to open: ") + indexPath);
+
+    std::vector<char> file{std::istreambuf_iterator<char>(indexFile), std::istreambuf_iterator<char>()};
+    const auto invalid = std::runtime_error(std::string("invalid or outdated ROM index: ") + indexPath);
+
+    indexHeader hdr;
+    if (file.size() < sizeof(hdr))
+        throw invalid;
+
+    std::memcpy(&hdr, file.data(), sizeof(hdr));
+    const size_t pathsOffset = sizeof(hdr) + size_t(hdr.count) * sizeof(indexRecord);
+    if (hdr.magic != indexMagic || hdr.version != indexVersion || pathsOffset + hdr.pathsSize != file.size())
+        throw invalid;
+
+    RomIndex index;
+    index.entries.reserve(hdr.count);
+    for (size_t i = 0; i < hdr.count; i++) {
+        indexRecord rec;
+        std::memcpy(&rec, file.data() + sizeof(hdr) + i * sizeof(rec), sizeof(rec));
+        if (size_t(rec.pathOffset) + rec.pathSize > hdr.pathsSize)
+            throw invalid;
+
+        RomIndexEntry entry;
+        entry.path       = std::string(file.data() + pathsOffset + rec.pathOffset, rec.pathSize);
+        entry.crc32      = rec.crc32;
+        entry.sha1       = rec.sha1;
+        entry.mapper     = rec.mapper;
+        entry.prgSize    = rec.prgSize;
+        entry.chrSize    = rec.chrSize;
+        entry.isNES2     = rec.flags & IndexFlags::NES2;
+        entry.hasBattery = rec.flags & IndexFlags::HasBattery;
+        entry.supported  = rec.flags & IndexFlags::Supported;
+        index.add(std::move(entry));
+    }
+
+    return index;
+}
+
+void RomIndex::save(const std::string &indexPath) const {
+    std::vector<indexRecord> records;
+    std::string paths;
+
+    for (auto &entry: this->entries) {
+        indexRecord rec{};
+        rec.sha1       = entry.sha1;
+        rec.crc32      = entry.crc32;
+        rec.mapper     = entry.mapper;
+        rec.prgSize    = entry.prgSize;
+        rec.chrSize    = entry.chrSize;
+        rec.pathOffset = uint32_t(paths.size());
+        rec.pathSize   = uint32_t(entry.path.size());
+        rec.flags      = (entry.supported ? IndexFlags::Supported : 0) | (entry.isNES2 ? IndexFlags::NES2 : 0) |
+                    (entry.hasBattery ? IndexFlags::HasBattery : 0);
+        records.push_back(rec);
+        paths += entry.path;
+    }
+
+    indexHeader hdr{};
+    hdr.magic     = indexMagic;
+    hdr.version   = indexVersion;
+    hdr.count     = uint32_t(records.size());
+    hdr.pathsSize = paths.size();
+
+    std::ofstream indexFile(indexPath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    if (!indexFile.is_open())
+        throw std::runtime_error(std::string("failed to open: ") + indexPath);
+
+    indexFile.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+    indexFile.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(indexRecord));
+    indexFile.write(paths.data(), paths.size());
+
+    if (!indexFile)
+        throw std::runtime_error(std::string("failed to write: ") + indexPath);
+}
+
+const RomIndexEntry *RomIndex::findPath(const std::string &path) const {
+    auto it = this->byPath.find(normalPath(path));
+    return it != this->byPath.end() ? &this->entries[it->second] : nullptr;
+}
+
+const RomIndexEntry *RomIndex::findSHA1(const std::array<Byte, 20> &sha1) const {
+    auto it = this->bySHA1.find(std::string(sha1.begin(), sha1.end()));
+    return it != this->bySHA1.end() ? &this->entries[it->second] : nullptr;
+}
+
+const std::vector<RomIndexEntry> &RomIndex::all() const {
+    return this->entries;
+}
+
+} // namespace nes
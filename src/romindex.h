@@ -0,0 +1,51 @@
+#pragma once
+#include "nes.h"
+#include <span>
+#include <string>
+#include <unordered_map>
+
+namespace nes {
+
+// The hashes ROM databases list: CRC-32 with the zlib polynomial, and SHA-1
+uint32_t CRC32(std::span<const Byte> data);
+std::array<Byte, 20> SHA1(std::span<const Byte> data);
+
+// What the index knows about one ROM file, enough to start a job without opening it
+struct RomIndexEntry {
+    std::string path;
+    uint32_t crc32 = 0; // of PRG and CHR ROM, without the header and trainer
+    std::array<Byte, 20> sha1{};
+    uint16_t mapper  = 0;
+    uint32_t prgSize = 0;
+    uint32_t chrSize = 0;
+    bool isNES2      = false;
+    bool hasBattery  = false;
+    bool supported   = false; // the mapper is implemented
+};
+
+// A ROM library: every .nes file under a directory with its hashes and header, saved to a single file.
+// Lookups by path or SHA-1 are hash table lookups.
+class RomIndex {
+private:
+    std::vector<RomIndexEntry> entries;
+    std::unordered_map<std::string, size_t> byPath;
+    std::unordered_map<std::string, size_t> bySHA1; // the raw digest as the key
+
+    void add(RomIndexEntry &&entry);
+
+public:
+    // Scan the directory tree and hash the files on numThreads cores. Files that can't be parsed are
+    // reported on stderr and left out.
+    static RomIndex Build(const std::string &dir, size_t numThreads);
+
+    // Throws std::runtime_error when the file isn't an index written by this version.
+    static RomIndex Load(const std::string &indexPath);
+    void save(const std::string &indexPath) const;
+
+    const RomIndexEntry *findPath(const std::string &path) const;
+    const RomIndexEntry *findSHA1(const std::array<Byte, 20> &sha1) const;
+
+    const std::vector<RomIndexEntry> &all() const;
+};
+
+} // namespace nes
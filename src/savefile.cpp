@@ -0,0 +1,88 @@
+#include "savefile.h"
+#include <fstream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace nes {
+
+std::shared_ptr<SaveFile> SaveFile::Open(const std::string &path, size_t size) {
+    std::shared_ptr<SaveFile> save(new SaveFile());
+    save->path = path;
+    save->size = size;
+
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t(st.st_size) < size && ftruncate(fd, off_t(size)) != 0)) {
+        if (fd >= 0)
+            close(fd);
+        throw std::runtime_error(std::string("failed to open save file: ") + path);
+    }
+
+    void *mapped = size > 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (mapped != MAP_FAILED) {
+        save->data    = static_cast<Byte *>(mapped);
+        save->flusher = std::thread(&SaveFile::flushLoop, save.get());
+        return save;
+    }
+#endif
+
+    std::ifstream saveFile(path, std::ios_base::binary | std::ios_base::in);
+    save->copy.assign(std::istreambuf_iterator<char>(saveFile), std::istreambuf_iterator<char>());
+    save->copy.resize(size);
+    save->data = save->copy.data();
+    return save;
+}
+
+SaveFile::~SaveFile() {
+    if (this->flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+
+        this->wakeFlusher.notify_one();
+        this->flusher.join();
+    }
+
+    this->flush();
+
+#ifndef _WIN32
+    if (this->data != nullptr && this->copy.empty())
+        munmap(this->data, this->size);
+#endif
+}
+
+std::span<Byte> SaveFile::bytes() const {
+    return {this->data, this->size};
+}
+
+void SaveFile::flush() {
+    if (this->copy.empty()) {
+#ifndef _WIN32
+        // only the pages written since the last sync go to disk
+        if (this->data != nullptr)
+            msync(this->data, this->size, MS_SYNC);
+#endif
+        return;
+    }
+
+    std::ofstream saveFile(this->path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    saveFile.write(reinterpret_cast<const char *>(this->copy.data()), this->copy.size());
+}
+
+void SaveFile::flushLoop() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (!this->wakeFlusher.wait_for(lock, FLUSH_INTERVAL, [this] { return this->stopping; }))
+        this->flush();
+}
+
+} // namespace nes
@@ -0,0 +1,45 @@
+#pragma once
+#include "nes.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+
+namespace nes {
+
+// Battery-backed RAM mapped read-write onto a .sav file. Writes go straight to the page cache, and a background
+// thread syncs them to disk every FLUSH_INTERVAL, so the emulation thread never waits on the disk.
+class SaveFile {
+private:
+    Byte *data  = nullptr;
+    size_t size = 0;
+    std::string path;
+    std::vector<Byte> copy; // where files can't be mapped, written back when closed
+
+    std::thread flusher;
+    std::mutex mutex;
+    std::condition_variable wakeFlusher;
+    bool stopping = false;
+
+    SaveFile() = default;
+    void flushLoop();
+
+public:
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{1000};
+
+    // Created with zeros when it doesn't exist yet, and extended when it's shorter than size
+    static std::shared_ptr<SaveFile> Open(const std::string &path, size_t size);
+    ~SaveFile();
+
+    SaveFile(const SaveFile &)            = delete;
+    SaveFile &operator=(const SaveFile &) = delete;
+
+    std::span<Byte> bytes() const;
+
+    // write everything to disk now
+    void flush();
+};
+
+} // namespace nes
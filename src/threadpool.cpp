@@ -0,0 +1,81 @@
+#include "threadpool.h"
+
+namespace nes {
+
+ThreadPool::ThreadPool(size_t numThreads) {
+    for (size_t i = 0; i < numThreads; i++)
+        this->workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+
+    this->wakeWorkers.notify_all();
+    for (auto &worker: this->workers)
+        worker.join();
+}
+
+size_t ThreadPool::size() const {
+    return this->workers.size();
+}
+
+bool ThreadPool::runNext(std::unique_lock<std::mutex> &lock) {
+    // called and returns with the lock held, but the item itself runs unlocked
+    if (this->nextIndex == this->batchSize)
+        return false;
+
+    auto index = this->nextIndex++;
+    lock.unlock();
+    this->batchFn(index);
+    lock.lock();
+
+    if (--this->remaining == 0)
+        this->batchDone.notify_all();
+
+    return true;
+}
+
+void ThreadPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (true) {
+        this->wakeWorkers.wait(lock, [this] { return this->stopping || this->nextIndex < this->batchSize; });
+        if (this->stopping)
+            return;
+
+        this->runNext(lock);
+    }
+}
+
+void ThreadPool::dispatch(size_t n, std::function<void(size_t)> fn) {
+    this->wait();
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->batchFn   = std::move(fn);
+        this->batchSize = n;
+        this->nextIndex = 0;
+        this->remaining = n;
+    }
+
+    this->wakeWorkers.notify_all();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (this->runNext(lock)) {
+    }
+
+    this->batchDone.wait(lock, [this] { return this->remaining == 0; });
+}
+
+void ThreadPool::parallelFor(size_t n, std::function<void(size_t)> fn) {
+    this->dispatch(n, std::move(fn));
+    this->wait();
+}
+
+} // namespace nes
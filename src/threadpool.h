@@ -0,0 +1,43 @@
+#pragma once
+#include "nes.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace nes {
+
+// A fixed set of worker threads that run batches of indexed work items, such as bands of scanlines.
+// Only one batch is in flight at a time: dispatching waits for the previous batch to finish.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wakeWorkers;
+    std::condition_variable batchDone;
+
+    std::function<void(size_t)> batchFn;
+    size_t batchSize = 0;
+    size_t nextIndex = 0;
+    size_t remaining = 0;
+    bool stopping    = false;
+
+    void workerLoop();
+    bool runNext(std::unique_lock<std::mutex> &lock);
+
+public:
+    ThreadPool(size_t numThreads);
+    ~ThreadPool();
+
+    size_t size() const;
+
+    // queue fn(0) ... fn(n - 1) on the workers and return immediately
+    void dispatch(size_t n, std::function<void(size_t)> fn);
+
+    // block until the dispatched batch has finished, running any unclaimed items on the calling thread
+    void wait();
+
+    void parallelFor(size_t n, std::function<void(size_t)> fn);
+};
+
+} // namespace nes
@@ -0,0 +1,302 @@
+#include <gtest/gtest.h>
+
+#define _NES_TEST
+#include "../src/apu.h"
+#include "../src/cartridge.h"
+#include "../src/console.h"
+#include "../src/cpu.h"
+#include <cstring>
+#include <utility>
+
+class CollectingSink : public nes::AudioSink {
+public:
+    std::vector<float> samples;
+
+    void writeSamples(float samples[], size_t n) override {
+        this->samples.insert(this->samples.end(), samples, samples + n);
+    }
+};
+
+// NROM with DMC sample bytes from $C000, and IRQs let through
+static std::shared_ptr<nes::Console> createConsole(const std::vector<nes::Byte> &prg) {
+    auto cartridge    = std::make_unique<nes::Cartridge>();
+    cartridge->prgROM = prg;
+    cartridge->chrRAM.resize(8192);
+
+    auto console = nes::Console::Create(nes::Mapper::Create(nes::MapperType::INESMapper000, std::move(cartridge)));
+    console->cpu->status[nes::Flag::I] = false;
+    return console;
+}
+
+static std::vector<nes::Byte> samplePRG() {
+    std::vector<nes::Byte> prg(0x8000, 0xEA);
+    for (size_t i = 0x4000; i < prg.size(); i++)
+        prg[i] = nes::Byte(i * 97 + (i >> 7));
+    return prg;
+}
+
+struct Access {
+    uint64_t cycle;
+    nes::Address addr;
+    int data; // -1 reads $4015
+};
+
+// what the CPU can see of the APU after an access, and the IRQ it has pending
+struct Observed {
+    int status;
+    nes::Interrupt interrupt;
+    uint16_t stalledCycles;
+    bool frameIRQ;
+    bool dmcIRQ;
+};
+
+static Observed access(nes::Console &console, const Access &a) {
+    Observed seen{};
+    if (a.data < 0)
+        seen.status = console.apu->readRegister(a.addr);
+    else
+        console.apu->writeRegister(a.addr, nes::Byte(a.data));
+
+    // the CPU takes the interrupt and the stall
+    seen.interrupt     = std::exchange(console.cpu->pendingInterrupt, nes::Interrupt::None);
+    seen.stalledCycles = std::exchange(console.cpu->stalledCycles, 0);
+    seen.frameIRQ      = console.apu->frameIRQ;
+    seen.dmcIRQ        = console.apu->dmc.irqFlag;
+    return seen;
+}
+
+static std::vector<Access> accessSequence() {
+    std::vector<Access> accesses = {
+            {0, 0x4017, 0x00}, // 4-step sequence with frame IRQs
+            {3, 0x4015, 0x1F},
+            {6, 0x4000, 0xBF},
+            {9, 0x4002, 0x40},
+            {12, 0x4003, 0x08},
+            {15, 0x4004, 0x74},
+            {18, 0x4005, 0x9A}, // sweep
+            {21, 0x4006, 0x90},
+            {24, 0x4007, 0x18},
+            {27, 0x4008, 0x81},
+            {30, 0x400A, 0x30},
+            {33, 0x400B, 0x08},
+            {36, 0x400C, 0x35},
+            {39, 0x400E, 0x05},
+            {42, 0x400F, 0x18},
+            {45, 0x4010, 0x8E}, // DMC with IRQ at the end, fast rate
+            {48, 0x4011, 0x40},
+            {51, 0x4012, 0x00}, // $C000
+            {54, 0x4013, 0x02}, // 33 bytes
+            {57, 0x4015, 0x1F},
+            {30000, 0x4002, 0x20},
+            {45003, 0x400E, 0x8A}, // short noise mode
+            {60000, 0x4010, 0x4F}, // looping, no IRQ
+            {60003, 0x4015, 0x1F},
+            {90000, 0x4017, 0x80}, // 5-step sequence, clocks everything right away
+            {120000, 0x4017, 0x00},
+            {150000, 0x4015, 0x0F}, // stop the DMC
+            {150003, 0x4017, 0x40}, // inhibit frame IRQs
+            {180000, 0x4008, 0x00},
+            {180003, 0x400B, 0x10},
+    };
+
+    // $4015 is polled throughout, also between the writes
+    for (uint64_t cycle = 1; cycle < 200000; cycle += 2999)
+        accesses.push_back({cycle, 0x4015, -1});
+    std::stable_sort(accesses.begin(), accesses.end(), [](auto &a, auto &b) { return a.cycle < b.cycle; });
+    return accesses;
+}
+
+// as StepFrame does: instructions of a few cycles, running the APU only when it asks for it
+static std::vector<Observed> runLazily(nes::Console &console, const std::vector<Access> &accesses, uint64_t end) {
+    std::vector<Observed> seen;
+    size_t next = 0;
+    for (console.cycles = 0; console.cycles <= end; console.cycles++) {
+        if (console.cycles % 3 == 0 && console.cycles > console.apu->nextSyncCycle())
+            console.apu->runUntil(console.cycles);
+
+        for (; next < accesses.size() && accesses[next].cycle == console.cycles; next++)
+            seen.push_back(access(console, accesses[next]));
+    }
+    return seen;
+}
+
+static void expectSameRuns(bool audioEnabled) {
+    const auto prg      = samplePRG();
+    const auto accesses = accessSequence();
+    const uint64_t end  = 210000;
+
+    CollectingSink lazySink, steppedSink;
+    auto lazy    = createConsole(prg);
+    auto stepped = createConsole(prg);
+    lazy->apu->setAudioSink(&lazySink);
+    stepped->apu->setAudioSink(&steppedSink);
+    lazy->SetAudioEnabled(audioEnabled);
+    stepped->SetAudioEnabled(audioEnabled);
+
+    const auto lazySeen = runLazily(*lazy, accesses, end);
+    std::vector<Observed> steppedSeen;
+
+    // every cycle stepped one at a time
+    size_t next = 0;
+    for (stepped->cycles = 0; stepped->cycles <= end; stepped->cycles++) {
+        for (; next < accesses.size() && accesses[next].cycle == stepped->cycles; next++)
+            steppedSeen.push_back(access(*stepped, accesses[next]));
+
+        stepped->apu->step();
+    }
+    stepped->cycles = stepped->apu->cycle;
+    lazy->cycles    = stepped->apu->cycle;
+    lazy->apu->endFrame();
+    stepped->apu->endFrame();
+
+    ASSERT_EQ(steppedSeen.size(), lazySeen.size());
+    for (size_t i = 0; i < lazySeen.size(); i++) {
+        EXPECT_EQ(steppedSeen[i].status, lazySeen[i].status) << "access " << i;
+        EXPECT_EQ(steppedSeen[i].interrupt, lazySeen[i].interrupt) << "access " << i;
+        EXPECT_EQ(steppedSeen[i].stalledCycles, lazySeen[i].stalledCycles) << "access " << i;
+        EXPECT_EQ(steppedSeen[i].frameIRQ, lazySeen[i].frameIRQ) << "access " << i;
+        EXPECT_EQ(steppedSeen[i].dmcIRQ, lazySeen[i].dmcIRQ) << "access " << i;
+    }
+
+    ASSERT_EQ(steppedSink.samples.size(), lazySink.samples.size());
+    EXPECT_EQ(steppedSink.samples, lazySink.samples);
+
+    EXPECT_EQ(0, std::memcmp(&stepped->apu->frameFeatures(), &lazy->apu->frameFeatures(), sizeof(nes::AudioFeatures)));
+
+    if (audioEnabled) {
+        EXPECT_GT(lazySink.samples.size(), 0u);
+    }
+}
+
+TEST(APUTest, LazyRunMatchesEveryCycle) {
+    expectSameRuns(true);
+}
+
+TEST(APUTest, LazyRunMatchesEveryCycleWithoutAudio) {
+    expectSameRuns(false);
+}
+
+TEST(APUTest, AudioThreadMatchesInlineSynthesis) {
+    const auto prg      = samplePRG();
+    const auto accesses = accessSequence();
+    const uint64_t end  = 210000;
+
+    CollectingSink inlineSink, threadedSink;
+    auto inlined  = createConsole(prg);
+    auto threaded = createConsole(prg);
+    inlined->apu->setAudioSink(&inlineSink);
+    threaded->apu->setAudioSink(&threadedSink);
+    threaded->SetAudioThread(true);
+
+    const auto inlineSeen   = runLazily(*inlined, accesses, end);
+    const auto threadedSeen = runLazily(*threaded, accesses, end);
+    inlined->apu->endFrame();
+    threaded->apu->endFrame();
+
+    // the worker synthesizes everything queued before it stops
+    threaded->SetAudioThread(false);
+
+    ASSERT_EQ(inlineSeen.size(), threadedSeen.size());
+    for (size_t i = 0; i < inlineSeen.size(); i++) {
+        EXPECT_EQ(inlineSeen[i].status, threadedSeen[i].status) << "access " << i;
+        EXPECT_EQ(inlineSeen[i].interrupt, threadedSeen[i].interrupt) << "access " << i;
+        EXPECT_EQ(inlineSeen[i].stalledCycles, threadedSeen[i].stalledCycles) << "access " << i;
+    }
+
+    EXPECT_GT(inlineSink.samples.size(), 0u);
+    EXPECT_EQ(inlineSink.samples, threadedSink.samples);
+}
+
+// https://www.nesdev.org/wiki/APU_DMC
+static nes::Byte readStatusAt(nes::Console &console, uint64_t cycle) {
+    console.cycles = cycle;
+    return console.apu->readRegister(0x4015);
+}
+
+static void writeAt(nes::Console &console, uint64_t cycle, nes::Address addr, nes::Byte data) {
+    console.cycles = cycle;
+    console.apu->writeRegister(addr, data);
+}
+
+// the fastest rate, a byte every 432 cycles, of a 17 byte sample at $C000
+static void startSample(nes::Console &console, uint64_t cycle, nes::Byte flags) {
+    writeAt(console, cycle, 0x4010, flags | 0x0F);
+    writeAt(console, cycle, 0x4012, 0x00);
+    writeAt(console, cycle, 0x4013, 0x01);
+    writeAt(console, cycle, 0x4015, 0x10);
+}
+
+TEST(APUTest, DMCSampleEndsWithoutIRQ) {
+    auto console = createConsole(samplePRG());
+    startSample(*console, 0, 0x00);
+
+    // the first byte is fetched right away, halting the CPU for 4 cycles
+    EXPECT_EQ(4, console->cpu->stalledCycles);
+    EXPECT_EQ(0x10, readStatusAt(*console, 1000) & 0x90);
+
+    EXPECT_EQ(0x00, readStatusAt(*console, 20000) & 0x90);
+    EXPECT_EQ(17 * 4, console->cpu->stalledCycles);
+    EXPECT_EQ(nes::Interrupt::None, console->cpu->pendingInterrupt);
+}
+
+TEST(APUTest, DMCSampleEndRaisesIRQ) {
+    auto console = createConsole(samplePRG());
+    startSample(*console, 0, 0x80);
+
+    EXPECT_EQ(0x10, readStatusAt(*console, 1000) & 0x90);
+    EXPECT_EQ(nes::Interrupt::None, console->cpu->pendingInterrupt);
+
+    // bit 7 is set at the last fetch, and reading $4015 doesn't clear it
+    EXPECT_EQ(0x80, readStatusAt(*console, 20000) & 0x90);
+    EXPECT_EQ(0x80, readStatusAt(*console, 20001) & 0x90);
+    EXPECT_EQ(17 * 4, console->cpu->stalledCycles);
+    EXPECT_EQ(nes::Interrupt::IRQ, console->cpu->pendingInterrupt);
+
+    // writing $4015 does
+    writeAt(*console, 20002, 0x4015, 0x00);
+    EXPECT_EQ(0x00, readStatusAt(*console, 20003) & 0x90);
+
+    // and so does disabling the IRQ
+    startSample(*console, 20004, 0x80);
+    EXPECT_EQ(0x80, readStatusAt(*console, 40000) & 0x90);
+    writeAt(*console, 40001, 0x4010, 0x0F);
+    EXPECT_EQ(0x00, readStatusAt(*console, 40002) & 0x90);
+}
+
+TEST(APUTest, DMCLoopRestartsTheSample) {
+    auto console = createConsole(samplePRG());
+    startSample(*console, 0, 0xC0);
+
+    // with loop set the IRQ flag is never raised, however many times the sample plays
+    for (uint64_t cycle = 1000; cycle < 40000; cycle += 1000)
+        EXPECT_EQ(0x10, readStatusAt(*console, cycle) & 0x90) << "at " << cycle;
+
+    EXPECT_EQ(nes::Interrupt::None, console->cpu->pendingInterrupt);
+
+    // about 90 bytes so far, each stalling the CPU for 4 cycles, which is the 17 byte sample played 5 times over
+    const uint16_t stalled = console->cpu->stalledCycles;
+    EXPECT_EQ(0, stalled % 4);
+    EXPECT_GT(stalled / 4, 5 * 17);
+    EXPECT_GE(console->apu->dmc.currentAddress, 0xC000);
+    EXPECT_LT(console->apu->dmc.currentAddress, 0xC000 + 17);
+}
+
+TEST(APUTest, FrameIRQFlag) {
+    auto console = createConsole(samplePRG());
+
+    // 4-step sequence with IRQs, which sets bit 6 at the end of every sequence
+    writeAt(*console, 0, 0x4017, 0x00);
+    EXPECT_EQ(0x00, readStatusAt(*console, 1000) & 0xC0);
+
+    EXPECT_EQ(0x40, readStatusAt(*console, 40000) & 0xC0);
+    EXPECT_EQ(nes::Interrupt::IRQ, console->cpu->pendingInterrupt);
+
+    // reading clears it
+    EXPECT_EQ(0x00, readStatusAt(*console, 40001) & 0xC0);
+
+    // so does setting the inhibit flag, which also stops it from being set again
+    EXPECT_EQ(0x40, readStatusAt(*console, 70000) & 0xC0);
+    writeAt(*console, 70001, 0x4017, 0x40);
+    EXPECT_EQ(0x00, readStatusAt(*console, 70002) & 0xC0);
+    EXPECT_EQ(0x00, readStatusAt(*console, 200000) & 0xC0);
+}
@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+
+#define _NES_TEST
+#include "../src/cartridge.h"
+#include "../src/console.h"
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+// MMC1 with CHR RAM and 8 KB of battery-backed PRG RAM, running NOPs
+static std::shared_ptr<nes::Console> createConsole(const std::vector<nes::Byte> &prg) {
+    auto cartridge        = std::make_unique<nes::Cartridge>();
+    cartridge->prgROM     = prg;
+    cartridge->hasBattery = true;
+    cartridge->chrRAM.resize(8192);
+    cartridge->prgRAM.resize(8192);
+
+    return nes::Console::Create(nes::Mapper::Create(nes::MapperType::INESMapper001, std::move(cartridge)));
+}
+
+TEST(ConsoleTest, ClonesDontSeeEachOthersRAMWrites) {
+    const std::vector<nes::Byte> prg(0x8000, 0xEA);
+    auto original = createConsole(prg);
+    auto &a       = *original->mapper;
+
+    a.Write(0x6000, 0x11);
+    a.Write(0x0010, 0x11);
+
+    auto clone = original->Clone();
+    auto &b    = *clone->mapper;
+
+    // the clone starts with everything written before
+    EXPECT_EQ(0x11, b.Read(0x6000));
+    EXPECT_EQ(0x11, b.Read(0x0010));
+
+    a.Write(0x6000, 0xAA);
+    a.Write(0x0010, 0xAA);
+    b.Write(0x6000, 0xBB);
+    b.Write(0x0010, 0xBB);
+    b.Write(0x6800, 0xCC);
+    b.Write(0x1800, 0xCC);
+
+    EXPECT_EQ(0xAA, a.Read(0x6000));
+    EXPECT_EQ(0xAA, a.Read(0x0010));
+    EXPECT_EQ(0x00, a.Read(0x6800));
+    EXPECT_EQ(0x00, a.Read(0x1800));
+
+    EXPECT_EQ(0xBB, b.Read(0x6000));
+    EXPECT_EQ(0xBB, b.Read(0x0010));
+    EXPECT_EQ(0xCC, b.Read(0x6800));
+    EXPECT_EQ(0xCC, b.Read(0x1800));
+
+    // the PPU fetches through the page tables, which follow the copies
+    EXPECT_EQ(0xAA, a.CHRPage(0x0010)[0x10]);
+    EXPECT_EQ(0xBB, b.CHRPage(0x0010)[0x10]);
+
+    // pages neither console wrote to are still shared
+    EXPECT_EQ(a.cartridge->prgRAM.page(0x1C00), b.cartridge->prgRAM.page(0x1C00));
+    EXPECT_EQ(a.cartridge->chrRAM.page(0x0C00), b.cartridge->chrRAM.page(0x0C00));
+    EXPECT_NE(a.cartridge->prgRAM.page(0x0000), b.cartridge->prgRAM.page(0x0000));
+    EXPECT_NE(a.cartridge->chrRAM.page(0x0000), b.cartridge->chrRAM.page(0x0000));
+
+    // and both keep running on their own
+    original->StepFrame();
+    clone->StepFrame();
+    EXPECT_EQ(0xAA, a.Read(0x6000));
+    EXPECT_EQ(0xBB, b.Read(0x6000));
+}
+
+TEST(ConsoleTest, ClonesRunOnTheirOwnThreads) {
+    const std::vector<nes::Byte> prg(0x8000, 0xEA);
+    auto original = createConsole(prg);
+    for (nes::Address addr = 0x6000; addr < 0x8000; addr++)
+        original->mapper->Write(addr, 0x11);
+
+    // a clone of a clone shares pages with both
+    std::vector<std::shared_ptr<nes::Console>> consoles = {original, original->Clone()};
+    consoles.push_back(consoles[1]->Clone());
+
+    // all of them write to every page they share at once, which must never land in another's RAM
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < consoles.size(); i++) {
+        threads.emplace_back([&console = *consoles[i], value = nes::Byte(0x20 + i)] {
+            for (int round = 0; round < 4; round++) {
+                for (nes::Address addr = 0x6000; addr < 0x8000; addr++)
+                    console.mapper->Write(addr, value);
+                for (nes::Address addr = 0; addr < 0x2000; addr++)
+                    console.mapper->Write(addr, value);
+                console.StepFrame();
+            }
+        });
+    }
+    for (auto &thread: threads)
+        thread.join();
+
+    for (size_t i = 0; i < consoles.size(); i++) {
+        auto &mapper = *consoles[i]->mapper;
+        for (nes::Address addr = 0x6000; addr < 0x8000; addr++)
+            ASSERT_EQ(0x20 + i, mapper.Read(addr)) << "console " << i << " at " << addr;
+        for (nes::Address addr = 0; addr < 0x2000; addr++)
+            ASSERT_EQ(0x20 + i, mapper.Read(addr)) << "console " << i << " at " << addr;
+    }
+}
+
+TEST(ConsoleTest, SaveFileRoundTrip) {
+    namespace fs = std::filesystem;
+    const auto path = (fs::temp_directory_path() / "nes_console_save_test.sav").string();
+    fs::remove(path);
+
+    const std::vector<nes::Byte> prg(0x8000, 0xEA);
+    {
+        // a new save starts out as zeros
+        auto console = createConsole(prg);
+        ASSERT_TRUE(console->UseSaveFile(path));
+        EXPECT_EQ(0x00, console->mapper->Read(0x6000));
+
+        console->mapper->Write(0x6000, 0x42);
+        console->mapper->Write(0x7FFF, 0x99);
+        console->StepFrame();
+    }
+
+    // everything is on disk once the console is gone
+    EXPECT_EQ(8192u, fs::file_size(path));
+    {
+        auto console = createConsole(prg);
+        ASSERT_TRUE(console->UseSaveFile(path));
+        EXPECT_EQ(0x42, console->mapper->Read(0x6000));
+        EXPECT_EQ(0x99, console->mapper->Read(0x7FFF));
+        EXPECT_EQ(0x00, console->mapper->Read(0x6001));
+    }
+
+    // a shorter save is extended with zeros, and keeps what it had
+    fs::resize_file(path, 4096);
+    {
+        auto console = createConsole(prg);
+        ASSERT_TRUE(console->UseSaveFile(path));
+        EXPECT_EQ(0x42, console->mapper->Read(0x6000));
+        EXPECT_EQ(0x00, console->mapper->Read(0x7FFF));
+    }
+    EXPECT_EQ(8192u, fs::file_size(path));
+
+    fs::remove(path);
+}
+
+TEST(ConsoleTest, ClonesNeverWriteToTheSaveFile) {
+    namespace fs = std::filesystem;
+    const auto path = (fs::temp_directory_path() / "nes_console_clone_test.sav").string();
+    {
+        const std::string saved(8192, char(0x5A));
+        std::ofstream(path, std::ios_base::binary | std::ios_base::trunc) << saved;
+    }
+
+    const std::vector<nes::Byte> prg(0x8000, 0xEA);
+    {
+        auto original = createConsole(prg);
+        ASSERT_TRUE(original->UseSaveFile(path));
+        EXPECT_EQ(0x5A, original->mapper->Read(0x6000));
+
+        auto clone = original->Clone();
+        EXPECT_EQ(nullptr, clone->mapper->cartridge->save);
+        EXPECT_EQ(0x5A, clone->mapper->Read(0x6000));
+
+        // every page of the clone is a copy, even the ones it never writes
+        for (size_t offset = 0; offset < 8192; offset += nes::PagedRAM::PAGE_SIZE)
+            EXPECT_NE(original->mapper->cartridge->prgRAM.page(offset), clone->mapper->cartridge->prgRAM.page(offset));
+
+        for (nes::Address addr = 0x6000; addr < 0x8000; addr++)
+            clone->mapper->Write(addr, 0x77);
+        original->mapper->Write(0x6001, 0x11);
+
+        EXPECT_EQ(0x5A, original->mapper->Read(0x6000));
+        EXPECT_EQ(0x77, clone->mapper->Read(0x6000));
+
+        // the clone goes first, and closing it must not touch the file either
+        clone.reset();
+    }
+
+    std::ifstream saveFile(path, std::ios_base::binary);
+    const std::vector<char> saved{std::istreambuf_iterator<char>(saveFile), std::istreambuf_iterator<char>()};
+    ASSERT_EQ(8192u, saved.size());
+    EXPECT_EQ(0x5A, saved[0]);
+    EXPECT_EQ(0x11, saved[1]);
+    for (size_t i = 2; i < saved.size(); i++)
+        ASSERT_EQ(0x5A, saved[i]) << "at " << i;
+
+    fs::remove(path);
+}
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include "../src/palette.h"
+#include <cstring>
+
+// color $27 (0xEA9E22) with red emphasis, which darkens green and blue to 3/4: 0xEA7619
+static const nes::PaletteIndex emphasizedOrange = 0x40 | 0x27;
+
+template<typename Pixel>
+static Pixel convertOne(nes::PixelFormat format) {
+    nes::PixelConverter converter(format);
+    EXPECT_EQ(sizeof(Pixel), converter.bytesPerPixel());
+
+    Pixel pixel;
+    converter.convert(&emphasizedOrange, 1, &pixel);
+    return pixel;
+}
+
+TEST(PaletteTest, PaletteRGBAppliesEmphasis) {
+    EXPECT_EQ(0xEA9E22u, nes::PaletteRGB(0x27));
+    EXPECT_EQ(0xEA7619u, nes::PaletteRGB(emphasizedOrange));
+
+    // all three bits darken every channel
+    EXPECT_EQ(0xAF7619u, nes::PaletteRGB(0x1C0 | 0x27));
+}
+
+TEST(PaletteTest, PixelConverterFormats) {
+    EXPECT_EQ(0xEA7619FFu, convertOne<uint32_t>(nes::PixelFormat::RGBA8888));
+    EXPECT_EQ(0x1976EAFFu, convertOne<uint32_t>(nes::PixelFormat::BGRA8888));
+    EXPECT_EQ(0xFFEA7619u, convertOne<uint32_t>(nes::PixelFormat::ARGB8888));
+    EXPECT_EQ(0xEBA3u, convertOne<uint16_t>(nes::PixelFormat::RGB565)); // 11101 011101 00011
+    EXPECT_EQ(142u, convertOne<uint8_t>(nes::PixelFormat::Luma8));
+}
+
+TEST(PaletteTest, PixelConverterRGB24StaysInBounds) {
+    nes::PixelConverter converter(nes::PixelFormat::RGB24);
+    ASSERT_EQ(3u, converter.bytesPerPixel());
+
+    // 4 byte stores for all but the last pixel, which must not touch the byte after it
+    const nes::PaletteIndex indices[] = {0x27, emphasizedOrange, 0x20};
+    std::array<nes::Byte, 10> out;
+    out.fill(0xAB);
+    converter.convert(indices, 3, out.data());
+
+    const std::array<nes::Byte, 10> want = {0xEA, 0x9E, 0x22, 0xEA, 0x76, 0x19, 0xFF, 0xFE, 0xFF, 0xAB};
+    EXPECT_EQ(want, out);
+}
+
+TEST(PaletteTest, PixelConverterMasksIndices) {
+    nes::PixelConverter converter(nes::PixelFormat::ARGB8888);
+
+    // only the low 9 bits are a palette index
+    const nes::PaletteIndex indices[] = {emphasizedOrange, nes::PaletteIndex(0xFE00 | emphasizedOrange)};
+    uint32_t out[2];
+    converter.convert(indices, 2, out);
+    EXPECT_EQ(out[0], out[1]);
+}
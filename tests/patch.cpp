@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include "../src/cartridge.h"
+#include "../src/patch.h"
+#include <filesystem>
+#include <fstream>
+
+// https://www.nesdev.org/wiki/Game_Genie#Decoding
+TEST(PatchTest, GameGenieSixLetters) {
+    auto code = nes::ParseGameGenieCode("GOSSIP");
+    EXPECT_EQ(0xD1DD, code.addr);
+    EXPECT_EQ(0x14, code.value);
+    EXPECT_FALSE(code.compare.has_value());
+
+    // Super Mario Bros. infinite lives, in lower case
+    code = nes::ParseGameGenieCode("sxiopo");
+    EXPECT_EQ(0x91D9, code.addr);
+    EXPECT_EQ(0xAD, code.value);
+    EXPECT_FALSE(code.compare.has_value());
+}
+
+TEST(PatchTest, GameGenieEightLetters) {
+    auto code = nes::ParseGameGenieCode("ZEXPYGLA");
+    EXPECT_EQ(0x94A7, code.addr);
+    EXPECT_EQ(0x02, code.value);
+    ASSERT_TRUE(code.compare.has_value());
+    EXPECT_EQ(0x03, *code.compare);
+}
+
+TEST(PatchTest, GameGenieInvalidCodes) {
+    EXPECT_THROW(nes::ParseGameGenieCode(""), std::runtime_error);
+    EXPECT_THROW(nes::ParseGameGenieCode("SXIOP"), std::runtime_error);
+    EXPECT_THROW(nes::ParseGameGenieCode("SXIOPOA"), std::runtime_error);
+    EXPECT_THROW(nes::ParseGameGenieCode("QQQQQQ"), std::runtime_error);
+}
+
+TEST(PatchTest, GameGenieCompareOnlyPatchesMatchingBanks) {
+    // UxROM with four 16 KB banks, each holding its number at $x123
+    std::vector<nes::Byte> prg(4 * 0x4000, 0xEA);
+    for (size_t bank = 0; bank < 4; bank++)
+        prg[bank * 0x4000 + 0x123] = nes::Byte(0x10 + bank);
+
+    auto cartridge    = std::make_unique<nes::Cartridge>();
+    cartridge->prgROM = prg;
+    cartridge->chrRAM.resize(8192);
+    auto mapper = nes::Mapper::Create(nes::MapperType::INESMapper002, std::move(cartridge));
+
+    // $8123 = $42 where it reads $10, which only bank 0 does
+    auto code = nes::ParseGameGenieCode("ZGXALPAP");
+    ASSERT_EQ(0x8123, code.addr);
+    ASSERT_EQ(0x42, code.value);
+    ASSERT_EQ(0x10, code.compare);
+    mapper->AddGameGenieCode(code);
+
+    EXPECT_EQ(0x42, mapper->Read(0x8123));
+    EXPECT_EQ(0xEA, mapper->Read(0x8124));
+
+    mapper->Write(0x8000, 1);
+    EXPECT_EQ(0x11, mapper->Read(0x8123));
+
+    mapper->Write(0x8000, 0);
+    EXPECT_EQ(0x42, mapper->Read(0x8123));
+
+    // the fixed last bank at $C000 is outside the code's address
+    EXPECT_EQ(0x13, mapper->Read(0xC123));
+}
+
+static std::string writePatch(const std::string &name, const std::vector<nes::Byte> &records) {
+    const auto path = (std::filesystem::temp_directory_path() / name).string();
+    std::ofstream patch(path, std::ios_base::binary);
+    patch << "PATCH";
+    patch.write(reinterpret_cast<const char *>(records.data()), std::streamsize(records.size()));
+    patch << "EOF";
+    return path;
+}
+
+static std::unique_ptr<nes::Cartridge> nromCartridge(const std::vector<nes::Byte> &prg,
+                                                     const std::vector<nes::Byte> &chr) {
+    auto cartridge           = std::make_unique<nes::Cartridge>();
+    cartridge->prgROM        = prg;
+    cartridge->chrROM        = chr;
+    cartridge->prgFileOffset = 16;
+    return cartridge;
+}
+
+TEST(PatchTest, IPSPatchWithRLERecord) {
+    const std::vector<nes::Byte> prg(0x4000, 0x00), chr(0x2000, 0x00);
+
+    // 3 bytes at PRG $0010, then an RLE record of 4 times $77 at CHR $0005
+    const std::vector<nes::Byte> records = {
+            0x00, 0x00, 0x20, 0x00, 0x03, 0xA9, 0x01, 0x60, // file offset $20 = 16 byte header + $10
+            0x00, 0x40, 0x15, 0x00, 0x00, 0x00, 0x04, 0x77, // file offset $4015 = header + 16 KB PRG + 5
+    };
+    const auto path = writePatch("nes_patch_test.ips", records);
+
+    auto cartridge = nromCartridge(prg, chr);
+    nes::ApplyIPSPatch(*cartridge, path);
+    auto mapper = nes::Mapper::Create(nes::MapperType::INESMapper000, std::move(cartridge));
+
+    // 16 KB of PRG is mirrored at $C000
+    EXPECT_EQ(0x00, mapper->Read(0x800F));
+    EXPECT_EQ(0xA9, mapper->Read(0x8010));
+    EXPECT_EQ(0x01, mapper->Read(0x8011));
+    EXPECT_EQ(0x60, mapper->Read(0xC012));
+    EXPECT_EQ(0x00, mapper->Read(0x8013));
+
+    EXPECT_EQ(0x00, mapper->Read(0x0004));
+    for (nes::Address addr = 0x0005; addr < 0x0009; addr++)
+        EXPECT_EQ(0x77, mapper->Read(addr));
+    EXPECT_EQ(0x00, mapper->Read(0x0009));
+
+    // the ROM itself is shared and never written
+    EXPECT_EQ(0x00, prg[0x10]);
+    EXPECT_EQ(0x00, chr[0x05]);
+
+    std::filesystem::remove(path);
+}
+
+TEST(PatchTest, IPSPatchRejectsHeaderWrites) {
+    const std::vector<nes::Byte> prg(0x4000, 0x00), chr(0x2000, 0x00);
+
+    // byte 4 of the iNES header is the PRG ROM size
+    const auto path = writePatch("nes_patch_header_test.ips", {0x00, 0x00, 0x04, 0x00, 0x01, 0x02});
+
+    auto cartridge = nromCartridge(prg, chr);
+    EXPECT_THROW(nes::ApplyIPSPatch(*cartridge, path), std::runtime_error);
+    EXPECT_TRUE(cartridge->prgPatches.empty());
+    EXPECT_TRUE(cartridge->chrPatches.empty());
+
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+
+#define _NES_TEST
+#include "../src/cartridge.h"
+#include "../src/console.h"
+#include "../src/cpu.h"
+#include "../src/ppu.h"
+#include <cstring>
+
+// NROM running an idle loop, with an NMI handler that scrolls by a frame counter plus the sprite zero hit flag
+static std::vector<nes::Byte> scrollingProgram() {
+    std::vector<nes::Byte> prg(0x8000, 0xEA);
+
+    const std::vector<nes::Byte> loop = {0x4C, 0x00, 0x80}; // $8000: JMP $8000
+    const std::vector<nes::Byte> nmi  = {
+            0xAD, 0x02, 0x20, // $8010: LDA $2002
+            0x29, 0x40,       //        AND #$40
+            0x18,             //        CLC
+            0x65, 0x00,       //        ADC $00
+            0x8D, 0x05, 0x20, //        STA $2005
+            0xA5, 0x00,       //        LDA $00
+            0x8D, 0x05, 0x20, //        STA $2005
+            0xE6, 0x00,       //        INC $00
+            0x40,             //        RTI
+    };
+    std::copy(loop.begin(), loop.end(), prg.begin());
+    std::copy(nmi.begin(), nmi.end(), prg.begin() + 0x10);
+
+    // NMI, reset and IRQ vectors
+    const std::vector<nes::Byte> vectors = {0x10, 0x80, 0x00, 0x80, 0x00, 0x80};
+    std::copy(vectors.begin(), vectors.end(), prg.end() - 6);
+    return prg;
+}
+
+static std::shared_ptr<nes::Console> createConsole(const std::vector<nes::Byte> &prg,
+                                                   const std::vector<nes::Byte> &chr) {
+    auto cartridge           = std::make_unique<nes::Cartridge>();
+    cartridge->prgROM        = prg;
+    cartridge->chrROM        = chr;
+    cartridge->mirroringMode = nes::Cartridge::MirroringMode::Vertical;
+
+    auto console = nes::Console::Create(nes::Mapper::Create(nes::MapperType::INESMapper000, std::move(cartridge)));
+    auto &ppu    = *console->ppu;
+
+    // fill the nametables and palettes, before the first frame so none of it is a raster effect
+    ppu.writeRegister(0x2006, 0x20);
+    ppu.writeRegister(0x2006, 0x00);
+    for (int i = 0; i < 0x1000; i++)
+        ppu.writeRegister(0x2007, nes::Byte(i * 37 + (i >> 5)));
+
+    ppu.writeRegister(0x2006, 0x3F);
+    ppu.writeRegister(0x2006, 0x00);
+    for (int i = 0; i < 32; i++)
+        ppu.writeRegister(0x2007, nes::Byte(i * 5 + 1));
+
+    // sprites all over the screen, with sprite zero over the background at (100, 100)
+    std::array<nes::Byte, 256> oam;
+    for (size_t i = 0; i < oam.size(); i++)
+        oam[i] = nes::Byte(i * 73 + 11);
+    oam[0] = 100;
+    oam[2] = 0;
+    oam[3] = 100;
+    ppu.writeDMA(oam.data());
+
+    ppu.writeRegister(0x2000, 0x90); // NMI, background at $1000
+    ppu.writeRegister(0x2001, 0x1E); // background and sprites, including the left 8 pixels
+    return console;
+}
+
+TEST(PPUTest, RenderThreadsDrawTheSameFrames) {
+    const auto prg = scrollingProgram();
+    std::vector<nes::Byte> chr(0x2000);
+    for (size_t i = 0; i < chr.size(); i++)
+        chr[i] = nes::Byte((i * 151) ^ (i >> 4) ^ 0x5A);
+
+    auto inlined  = createConsole(prg, chr);
+    auto threaded = createConsole(prg, chr);
+    inlined->SetRenderThreads(0);
+    threaded->SetRenderThreads(3);
+
+    for (int frame = 0; frame < 20; frame++) {
+        inlined->StepFrame();
+        threaded->StepFrame();
+
+        // the pool finishes each frame before the next one begins
+        const auto &want = inlined->ppu->completedScreen();
+        const auto &got  = threaded->ppu->completedScreen();
+        ASSERT_EQ(inlined->ppu->currentFrame(), threaded->ppu->currentFrame());
+        for (int y = 0; y < nes::PPU::SCREEN_HEIGHT; y++)
+            ASSERT_EQ(0, std::memcmp(want[y], got[y], sizeof(want[y]))) << "frame " << frame << ", line " << y;
+    }
+}
+
+TEST(PPUTest, DrawFrameHonorsPitchAndScaling) {
+    const auto prg = scrollingProgram();
+    std::vector<nes::Byte> chr(0x2000);
+    for (size_t i = 0; i < chr.size(); i++)
+        chr[i] = nes::Byte(i * 29 + (i >> 3));
+
+    auto console = createConsole(prg, chr);
+    console->StepFrame();
+    console->StepFrame();
+
+    const auto check = [&console](uint32_t sdlFormat, nes::PixelFormat format, int scaling) {
+        nes::PixelConverter converter(format);
+        const size_t bytesPerPixel = converter.bytesPerPixel();
+
+        // every line of the frame, tightly packed
+        const size_t linePitch = nes::PPU::SCREEN_WIDTH * bytesPerPixel;
+        std::vector<nes::Byte> frame(nes::PPU::SCREEN_HEIGHT * linePitch);
+        console->ConvertFrame(converter, frame.data(), linePitch);
+
+        // a surface with padding after each row, which must be left alone
+        const int width  = nes::PPU::SCREEN_WIDTH * scaling;
+        const int height = nes::PPU::SCREEN_HEIGHT * scaling;
+        const int pitch  = int(width * bytesPerPixel) + 13;
+        std::vector<nes::Byte> pixels(size_t(height) * pitch, 0xAB);
+        auto surface = SDL_CreateRGBSurfaceWithFormatFrom(pixels.data(), width, height, int(8 * bytesPerPixel),
+                                                          pitch, sdlFormat);
+        ASSERT_NE(nullptr, surface);
+        console->DrawFrame(surface, uint8_t(scaling));
+        SDL_FreeSurface(surface);
+
+        for (int y = 0; y < height; y++) {
+            const nes::Byte *row = &pixels[size_t(y) * pitch];
+            for (int x = 0; x < width; x++) {
+                const nes::Byte *want = &frame[(y / scaling) * linePitch + (x / scaling) * bytesPerPixel];
+                ASSERT_EQ(0, std::memcmp(want, row + x * bytesPerPixel, bytesPerPixel)) << "at " << x << ", " << y;
+            }
+            for (int x = int(width * bytesPerPixel); x < pitch; x++)
+                ASSERT_EQ(0xAB, row[x]) << "padding written on row " << y;
+        }
+    };
+
+    check(SDL_PIXELFORMAT_ARGB8888, nes::PixelFormat::ARGB8888, 1);
+    check(SDL_PIXELFORMAT_RGB565, nes::PixelFormat::RGB565, 2);
+    check(SDL_PIXELFORMAT_RGB24, nes::PixelFormat::RGB24, 1);
+    check(SDL_PIXELFORMAT_RGB24, nes::PixelFormat::RGB24, 3);
+}
+
+TEST(PPUTest, OAMDMAWrapsAroundFromOAMADDR) {
+    const auto prg = scrollingProgram();
+    std::vector<nes::Byte> chr(0x2000);
+    auto console = createConsole(prg, chr);
+    auto &ppu    = *console->ppu;
+
+    std::array<nes::Byte, 256> page;
+    for (size_t i = 0; i < page.size(); i++)
+        page[i] = nes::Byte(i ^ 0xA5);
+
+    for (const int oamAddr: {0x00, 0x01, 0x81, 0xFF}) {
+        ppu.writeRegister(0x2003, nes::Byte(oamAddr));
+        ppu.writeDMA(page.data());
+
+        // byte i of the page lands at OAMADDR + i, and OAMADDR ends up where it started
+        for (int i = 0; i < 256; i++)
+            ASSERT_EQ(page[i], ppu.oam[(oamAddr + i) & 0xFF]) << "OAMADDR " << oamAddr << ", byte " << i;
+        EXPECT_EQ(page[0], ppu.readRegister(0x2004));
+
+        // the sprites come from OAM, not from the page
+        EXPECT_EQ(page[(256 - oamAddr) & 0xFF], ppu.primarySprites()[0].yPosTop);
+    }
+}
+
+// the dots at which the MMC3 counter raises its IRQ over a frame, with the counter reloading on every line
+static std::vector<std::pair<int, int>> mmc3IRQDots(nes::Byte ppuCtrl) {
+    auto cartridge    = std::make_unique<nes::Cartridge>();
+    cartridge->prgROM = std::vector<nes::Byte>(0x8000, 0xEA);
+    cartridge->chrROM = std::vector<nes::Byte>(0x2000);
+
+    auto console = nes::Console::Create(nes::Mapper::Create(nes::MapperType::INESMapper004, std::move(cartridge)));
+    auto &ppu    = *console->ppu;
+    auto &cpu    = *console->cpu;
+    cpu.status[nes::Flag::I] = false;
+
+    console->mapper->Write(0xC000, 0); // latch 0 clocks an IRQ on every line
+    console->mapper->Write(0xC001, 0);
+    console->mapper->Write(0xE001, 0);
+    ppu.writeRegister(0x2000, ppuCtrl);
+    ppu.writeRegister(0x2001, 0x18);
+
+    std::vector<std::pair<int, int>> dots;
+    for (int dot = 0; dot < 262 * 341; dot++) {
+        ppu.step();
+        if (cpu.pendingInterrupt == nes::Interrupt::IRQ) {
+            dots.emplace_back(ppu.scanLine, ppu.cycleInScanLine);
+            cpu.pendingInterrupt = nes::Interrupt::None;
+        }
+    }
+    return dots;
+}
+
+TEST(PPUTest, MMC3IRQFollowsTheA12Edge) {
+    const auto expectDot = [](nes::Byte ppuCtrl, int want) {
+        const auto dots = mmc3IRQDots(ppuCtrl);
+
+        // the visible lines and the pre-render line, none during vblank
+        ASSERT_EQ(241u, dots.size()) << "PPUCTRL " << int(ppuCtrl);
+        for (auto [line, dot] : dots) {
+            EXPECT_TRUE(line <= 239 || line == 261) << "line " << line;
+            ASSERT_EQ(want, dot) << "PPUCTRL " << int(ppuCtrl) << ", line " << line;
+        }
+    };
+
+    expectDot(0x08, 260); // sprites at $1000
+    expectDot(0x10, 324); // background at $1000, so A12 rises at the next line's prefetch
+    expectDot(0x30, 260); // 8x16 sprites fetch from either table
+    expectDot(0x00, 260);
+}
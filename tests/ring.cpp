@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+
+#include "../src/ring.h"
+#include <numeric>
+
+TEST(RingTest, CapacityIsAPowerOfTwo) {
+    nes::SPSCRing<int> ring(5);
+    EXPECT_EQ(8u, ring.capacity());
+    EXPECT_EQ(0u, ring.size());
+}
+
+TEST(RingTest, SinglePushesWrapAround) {
+    nes::SPSCRing<int> ring(4);
+    int next = 0, expected = 0;
+
+    // keep the ring between half and completely full while the indices go around it many times
+    for (int round = 0; round < 10; round++) {
+        while (ring.push(next))
+            next++;
+        EXPECT_EQ(4u, ring.size());
+
+        int out[2];
+        ASSERT_EQ(2u, ring.pop(out, 2));
+        EXPECT_EQ(expected++, out[0]);
+        EXPECT_EQ(expected++, out[1]);
+    }
+}
+
+TEST(RingTest, BulkPushAndPopWrapAround) {
+    nes::SPSCRing<int> ring(8);
+    std::vector<int> in(6), out(8);
+
+    std::iota(in.begin(), in.end(), 0);
+    ASSERT_EQ(6u, ring.push(in.data(), in.size()));
+    ASSERT_EQ(4u, ring.pop(out.data(), 4));
+
+    // 2 left at the end of the buffer, then 6 more of which 4 wrap to the start
+    std::iota(in.begin(), in.end(), 6);
+    ASSERT_EQ(6u, ring.push(in.data(), in.size()));
+    EXPECT_EQ(8u, ring.size());
+
+    // full, so nothing else fits
+    EXPECT_EQ(0u, ring.push(in.data(), 1));
+    EXPECT_FALSE(ring.push(in[0]));
+
+    ASSERT_EQ(8u, ring.pop(out.data(), out.size()));
+    for (int i = 0; i < 8; i++)
+        EXPECT_EQ(i + 4, out[i]);
+    EXPECT_EQ(0u, ring.pop(out.data(), out.size()));
+}
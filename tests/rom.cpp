@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+
+#include "../src/cartridge.h"
+#include "../src/rom.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+static std::span<const nes::Byte> bytes(const std::vector<nes::Byte> &v) {
+    return {v.data(), v.size()};
+}
+
+// iNES header followed by the PRG and CHR ROM it announces, PRG filled with 0x11 and CHR with 0x22
+static std::vector<nes::Byte> inesFile(uint8_t prgBanks, uint8_t chrBanks, uint8_t flags6 = 0) {
+    std::vector<nes::Byte> file = {'N', 'E', 'S', 0x1a, prgBanks, chrBanks, flags6, 0};
+    file.resize(16, 0);
+    file.resize(16 + prgBanks * 16384, 0x11);
+    file.resize(16 + prgBanks * 16384 + chrBanks * 8192, 0x22);
+    return file;
+}
+
+TEST(RomTest, ParseRomHeader) {
+    const auto file   = inesFile(2, 1, 0x01 | 0x02 | 0x10);
+    const auto layout = nes::ParseRomHeader(bytes(file), "test.nes");
+
+    EXPECT_EQ(nes::MapperType::INESMapper001, layout.mapperType);
+    EXPECT_EQ(nes::Cartridge::MirroringMode::Vertical, layout.mirroringMode);
+    EXPECT_FALSE(layout.isNES2);
+    EXPECT_TRUE(layout.hasBattery);
+    EXPECT_EQ(16u, layout.prgOffset);
+    EXPECT_EQ(32768u, layout.prgSize);
+    EXPECT_EQ(16u + 32768, layout.chrOffset);
+    EXPECT_EQ(8192u, layout.chrSize);
+    EXPECT_EQ(8192u, layout.prgRAMSize);
+}
+
+TEST(RomTest, ParseRomHeaderRejectsPRGSizes) {
+    // no PRG ROM at all
+    EXPECT_THROW(nes::ParseRomHeader(bytes(inesFile(0, 1)), "test.nes"), std::runtime_error);
+
+    // NES 2.0 exponent form: 2^13 * 1 bytes, half a bank
+    auto file = inesFile(1, 1);
+    file[4]   = 13 << 2;
+    file[7]   = 0x08;
+    file[9]   = 0x0F;
+    EXPECT_THROW(nes::ParseRomHeader(bytes(file), "test.nes"), std::runtime_error);
+
+    // and 2^14 * 1 bytes, a whole one
+    file[4] = 14 << 2;
+    EXPECT_EQ(16384u, nes::ParseRomHeader(bytes(file), "test.nes").prgSize);
+}
+
+TEST(RomTest, ParseRomHeaderRejectsOversizedNES2Sizes) {
+    // 16 KB PRG, and CHR of 2^63 bytes in exponent form, which wraps around when added to the offsets
+    auto file = inesFile(1, 1);
+    file[5]   = 63 << 2;
+    file[7]   = 0x08;
+    file[9]   = 0xF0;
+    EXPECT_THROW(nes::ParseRomHeader(bytes(file), "test.nes"), std::runtime_error);
+
+    // 3 * 2^63 bytes of PRG doesn't fit a size_t at all
+    file[4] = 63 << 2 | 1;
+    file[5] = 62 << 2;
+    file[9] = 0xFF;
+    EXPECT_THROW(nes::ParseRomHeader(bytes(file), "test.nes"), std::runtime_error);
+
+    // the sizes from the header all have to be in the file
+    file = inesFile(2, 1);
+    file.pop_back();
+    EXPECT_THROW(nes::ParseRomHeader(bytes(file), "test.nes"), std::runtime_error);
+
+    // including the trainer before PRG ROM
+    file = inesFile(1, 0, 0x04);
+    EXPECT_THROW(nes::ParseRomHeader(bytes(file), "test.nes"), std::runtime_error);
+    file.resize(file.size() + 512);
+    EXPECT_EQ(16u + 512, nes::ParseRomHeader(bytes(file), "test.nes").prgOffset);
+}
+
+static void writeFile(const std::string &path, const std::vector<nes::Byte> &contents) {
+    std::ofstream(path, std::ios_base::binary | std::ios_base::trunc)
+            .write(reinterpret_cast<const char *>(contents.data()), std::streamsize(contents.size()));
+}
+
+static std::vector<nes::Byte> readFile(const std::string &path) {
+    std::ifstream file(path, std::ios_base::binary);
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+TEST(RomTest, CacheRoundTrip) {
+    namespace fs = std::filesystem;
+    const auto romPath   = (fs::temp_directory_path() / "nes_rom_cache_test.nes").string();
+    const auto cachePath = (fs::temp_directory_path() / "nes_rom_cache_test.nescache").string();
+
+    // MMC1 with battery-backed RAM, vertical mirroring, and different bytes all over PRG and CHR
+    auto rom = inesFile(2, 2, 0x01 | 0x02 | 0x10);
+    for (size_t i = 16; i < rom.size(); i++)
+        rom[i] = nes::Byte(i * 131 + (i >> 9));
+    writeFile(romPath, rom);
+
+    nes::WriteRomCache(romPath, cachePath);
+    {
+        auto want = nes::LoadRomFile(romPath);
+        auto got  = nes::LoadRomFile(cachePath);
+        auto &a   = *want->cartridge;
+        auto &b   = *got->cartridge;
+
+        EXPECT_TRUE(std::equal(a.prgROM.begin(), a.prgROM.end(), b.prgROM.begin(), b.prgROM.end()));
+        EXPECT_TRUE(std::equal(a.chrROM.begin(), a.chrROM.end(), b.chrROM.begin(), b.chrROM.end()));
+        EXPECT_EQ(a.mirroringMode, b.mirroringMode);
+        EXPECT_EQ(a.hasBattery, b.hasBattery);
+        EXPECT_EQ(a.prgRAM.size(), b.prgRAM.size());
+        EXPECT_EQ(a.chrRAM.size(), b.chrRAM.size());
+        EXPECT_EQ(a.prgFileOffset, b.prgFileOffset);
+
+        // the views are page aligned in the mapping
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(b.prgROM.data()) % 4096);
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(b.chrROM.data()) % 4096);
+
+        // and the mappers read the same
+        for (uint32_t addr = 0x8000; addr <= 0xFFFF; addr += 0x123)
+            ASSERT_EQ(want->Read(nes::Address(addr)), got->Read(nes::Address(addr))) << "at " << addr;
+
+        // a cache can't be cached again
+        EXPECT_THROW(nes::WriteRomCache(cachePath, cachePath + ".again"), std::runtime_error);
+    }
+
+    fs::remove(romPath);
+    fs::remove(cachePath);
+}
+
+TEST(RomTest, CacheRejectsCorruptHeaders) {
+    namespace fs = std::filesystem;
+    const auto romPath   = (fs::temp_directory_path() / "nes_rom_corrupt_test.nes").string();
+    const auto cachePath = (fs::temp_directory_path() / "nes_rom_corrupt_test.nescache").string();
+    writeFile(romPath, inesFile(1, 1));
+    nes::WriteRomCache(romPath, cachePath);
+    const auto cache = readFile(cachePath);
+
+    // each is written to its own file, as loaded images are shared by file identity
+    const auto expectRejected = [](const std::string &path, const std::vector<nes::Byte> &contents) {
+        writeFile(path, contents);
+        EXPECT_THROW(nes::LoadRomFile(path), std::runtime_error) << path;
+        fs::remove(path);
+    };
+
+    // cut off in the middle of the CHR ROM
+    expectRejected(cachePath + ".truncated", std::vector<nes::Byte>(cache.begin(), cache.end() - 100));
+
+    // another version, at offset 8
+    auto corrupt = cache;
+    corrupt[8]++;
+    expectRejected(cachePath + ".version", corrupt);
+
+    // a mirroring mode past four-screen, at offset 14
+    corrupt     = cache;
+    corrupt[14] = 4;
+    expectRejected(cachePath + ".mirroring", corrupt);
+
+    // a PRG ROM that ends past the end of the file: offset and size at 32 and 40
+    corrupt                 = cache;
+    const uint64_t hugeSize = UINT64_MAX - 16383; // whole banks, wrapping the end offset around
+    std::memcpy(&corrupt[40], &hugeSize, sizeof(hugeSize));
+    expectRejected(cachePath + ".prgsize", corrupt);
+
+    fs::remove(romPath);
+    fs::remove(cachePath);
+}
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+
+#include "../src/romindex.h"
+#include <filesystem>
+#include <fstream>
+
+static std::span<const nes::Byte> bytes(const std::string &s) {
+    return {reinterpret_cast<const nes::Byte *>(s.data()), s.size()};
+}
+
+static std::string hex(const std::array<nes::Byte, 20> &digest) {
+    std::string out;
+    char buf[3];
+    for (auto b: digest) {
+        snprintf(buf, sizeof(buf), "%02x", b);
+        out += buf;
+    }
+    return out;
+}
+
+TEST(RomIndexTest, CRC32KnownAnswers) {
+    EXPECT_EQ(0x00000000u, nes::CRC32(bytes("")));
+    EXPECT_EQ(0x352441c2u, nes::CRC32(bytes("abc")));
+    EXPECT_EQ(0xcbf43926u, nes::CRC32(bytes("123456789")));
+
+    // whole 8 byte slices, with and without a tail
+    EXPECT_EQ(0xaadfe34eu, nes::CRC32(bytes(std::string(55, 'a'))));
+    EXPECT_EQ(0x79790d37u, nes::CRC32(bytes(std::string(56, 'a'))));
+    EXPECT_EQ(0x89b46555u, nes::CRC32(bytes(std::string(64, 'a'))));
+    EXPECT_EQ(0x9a38da03u, nes::CRC32(bytes(std::string(1000, 'a'))));
+}
+
+TEST(RomIndexTest, SHA1KnownAnswers) {
+    EXPECT_EQ("da39a3ee5e6b4b0d3255bfef95601890afd80709", hex(nes::SHA1(bytes(""))));
+    EXPECT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d", hex(nes::SHA1(bytes("abc"))));
+
+    // 55 bytes still fit the padding into one block, 56 need a second one, 64 are a whole block
+    EXPECT_EQ("c1c8bbdc22796e28c0e15163d20899b65621d65a", hex(nes::SHA1(bytes(std::string(55, 'a')))));
+    EXPECT_EQ("c2db330f6083854c99d4b5bfb6e8f29f201be699", hex(nes::SHA1(bytes(std::string(56, 'a')))));
+    EXPECT_EQ("0098ba824b5c16427bd7a1122a5a442a25ec644d", hex(nes::SHA1(bytes(std::string(64, 'a')))));
+    EXPECT_EQ("291e9a6c66994949b57ba5e650361e98fc36b1ba", hex(nes::SHA1(bytes(std::string(1000, 'a')))));
+}
+
+static void writeRom(const std::filesystem::path &path, uint8_t mapper, uint8_t fill) {
+    // iNES header with 16 KB PRG and 8 KB CHR
+    std::string rom = {'N', 'E', 'S', 0x1a, 1, 1, char(mapper << 4), 0};
+    rom.resize(16, 0);
+    rom.append(16384 + 8192, char(fill));
+
+    std::ofstream(path, std::ios_base::binary) << rom;
+}
+
+TEST(RomIndexTest, SaveLoadRoundTrip) {
+    namespace fs = std::filesystem;
+    const fs::path dir = fs::temp_directory_path() / "nes_romindex_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir / "sub");
+    writeRom(dir / "a.nes", 0, 0x11);
+    writeRom(dir / "sub" / "b.NES", 4, 0x22);
+    writeRom(dir / "sub" / "unsupported.nes", 9, 0x33);
+    std::ofstream(dir / "notes.txt") << "not a rom";
+
+    auto built = nes::RomIndex::Build(dir.string(), 2);
+    ASSERT_EQ(3u, built.all().size());
+
+    const std::string indexPath = (dir / "roms.index").string();
+    built.save(indexPath);
+    auto loaded = nes::RomIndex::Load(indexPath);
+
+    ASSERT_EQ(built.all().size(), loaded.all().size());
+    for (size_t i = 0; i < built.all().size(); i++) {
+        const auto &want = built.all()[i];
+        const auto &got  = loaded.all()[i];
+        EXPECT_EQ(want.path, got.path);
+        EXPECT_EQ(want.crc32, got.crc32);
+        EXPECT_EQ(want.sha1, got.sha1);
+        EXPECT_EQ(want.mapper, got.mapper);
+        EXPECT_EQ(want.prgSize, got.prgSize);
+        EXPECT_EQ(want.chrSize, got.chrSize);
+        EXPECT_EQ(want.isNES2, got.isNES2);
+        EXPECT_EQ(want.hasBattery, got.hasBattery);
+        EXPECT_EQ(want.supported, got.supported);
+
+        EXPECT_EQ(loaded.findPath(got.path), &got);
+        EXPECT_EQ(loaded.findSHA1(got.sha1), &got);
+    }
+
+    auto *b = loaded.findPath((dir / "sub" / "b.NES").string());
+    ASSERT_NE(nullptr, b);
+    EXPECT_EQ(4, b->mapper);
+    EXPECT_TRUE(b->supported);
+
+    auto *unsupported = loaded.findPath((dir / "sub" / "unsupported.nes").string());
+    ASSERT_NE(nullptr, unsupported);
+    EXPECT_FALSE(unsupported->supported);
+
+    // the hashes cover PRG and CHR without the header
+    std::string rom(16384 + 8192, char(0x11));
+    auto *a = loaded.findPath((dir / "a.nes").string());
+    ASSERT_NE(nullptr, a);
+    EXPECT_EQ(nes::CRC32(bytes(rom)), a->crc32);
+    EXPECT_EQ(nes::SHA1(bytes(rom)), a->sha1);
+
+    fs::remove_all(dir);
+}